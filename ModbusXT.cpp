@@ -7,6 +7,10 @@ if you have any question, please feel free to email me at mr.caddish@gmail.com
 */
 #include "ModbusXT.h"
 
+#if defined(__AVR__)
+#include <util/atomic.h>
+#endif
+
 #define IDLE 1
 #define WAITING_FOR_REPLY 2
 #define WAITING_FOR_TURNAROUND 3
@@ -16,18 +20,73 @@ if you have any question, please feel free to email me at mr.caddish@gmail.com
 #define ILLEGAL_DATA_VALUE 3
 
 
-#define DEBUG_UART 0
-
 #define DEBUG_HMI 1
 
 
-#if DEBUG_UART
-#define print(x) Serial.print(x)
-#define println(x) Serial.println(x)
+/*
+Atomic operations of submission queue. AVR and Cortex-M0 have no compare and swap,
+there it runs with interrupts masked for a few cycles, so it is still safe in interrupts.
+Loads and stores of one byte are atomic on all boards. On AVR only the compiler
+may reorder memory accesses around them, a barrier keeps data before its flag.
+*/
+static inline uint8_t atomicLoad(volatile uint8_t* p)
+{
+#if defined(__AVR__)
+	uint8_t value = *p;
+	__asm__ __volatile__("" ::: "memory");
+	return value;
 #else
-	#define print(x)
-	#define println(x)
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
 #endif
+}
+
+static inline void atomicStore(volatile uint8_t* p, uint8_t value)
+{
+#if defined(__AVR__)
+	__asm__ __volatile__("" ::: "memory");
+	*p = value;
+#else
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline bool atomicSwap(volatile uint8_t* p, uint8_t expected, uint8_t value)
+{
+#if defined(__AVR__)
+	bool swapped = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (*p == expected)
+		{
+			*p = value;
+			swapped = true;
+		}
+	}
+	return swapped;
+#elif defined(__ARM_ARCH_6M__)
+	bool swapped = false;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (*p == expected)
+	{
+		*p = value;
+		swapped = true;
+	}
+	__set_PRIMASK(primask);
+	return swapped;
+#else
+	return __atomic_compare_exchange_n(p, &expected, value, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#endif
+}
+
+//Protocol events are recorded into trace ring, see traceEvent
+#if MODBUS_TRACE
+#define trace(event, value) traceEvent(event, value)
+#else
+#define trace(event, value)
+#endif
+
+ModbusClock Modbus::_system_clock;
 
 //-----------------------------------------------------------------------------------
 /* Request packet from slaver
@@ -61,94 +120,724 @@ uint8_t Modbus::response()
  */
 void Modbus::request()
 {
-	static uint8_t packet_index = 0;
+	if (atomicLoad(&_staged))
+		publishTable();
+
+	if (nextPacket())
+		constructPacket();
+}
+
+void Modbus::update()
+{
+	//Staged packet table is taken when no packet is selected or in progress
+	if (_transmission_ready_flag && !_gap_hold && atomicLoad(&_staged))
+		publishTable();
+
+	//Selected packet is held until its gap is finished
+	if (_transmission_ready_flag && (_gap_hold || nextPacket()))
+	{
+		_gap_hold = !gapFinished();
+		if (!_gap_hold)
+			constructPacket();
+	}
+	_bus_empty = _transmission_ready_flag && !_gap_hold;	//nothing to send
+
+	//check response packet
+	checkPacket();
+
+	status();
+}
+
+//-----------------------------------------------------------------------------------
+/* Select next packet to send
+ * @param: none
+ * @return: false if there is no packet to send
+ * @private
+ * @comment: one-shot packet in progress is retried first, then queued one-shot
+ *			packets in priority order, then cyclic packets in round-robin. A block
+ *			transfer takes the turn of a cyclic packet while it is owed bus time.
+ *			Cyclic packets which can share a transaction are grouped from _packet on
+ */
+bool Modbus::nextPacket()
+{
+#if MODBUS_GROUP
+	_group_size = 1;
+#endif
+
+	drainSubmitted();
+
+	//Retry one-shot packet until it is successful or reaches max retry
+	if (_oneshot)
+	{
+		_packet = _oneshot;
+		return true;
+	}
+
+	//Queued one-shot packets preempt the cyclic scan
+	if (_queue_count)
+	{
+		_oneshot = _queue[0].packet;
+
+		_queue_latency = _clock->millis() - _queue[0].queued_time;
+		if (_queue_latency > _queue_latency_max)
+			_queue_latency_max = _queue_latency;
+
+		_queue_count--;
+		for (uint8_t i = 0; i < _queue_count; i++)
+			_queue[i] = _queue[i + 1];
+
+		_packet = _oneshot;
+		return true;
+	}
+
+	if (_block && _block_debt >= 0)
+		return nextChunk();
+
+	if (_total_packets == 0)
+		return nextChunk();
+
 	unsigned int failed_connections = 0;
 	
 	unsigned char current_connection;
 
-	// if (packet_index == _total_packets )
-	// 	packet_index = 0;
-	// _packet = &_packet_array[packet_index];
-	// packet_index++;
-	// constructPacket();
+	do
+	{		
+		if (_packet_index >= _total_packets) // wrap around to the beginning
+			_packet_index = 0;
+	
+		// get the current connection status
+		current_connection = connected(_packet_index);
+	
+		if (!current_connection)
+		{		
+			// If all the connection attributes are false return
+			// immediately to the main sketch
+			if (++failed_connections == _total_packets)
+				return nextChunk();
+		}
+	
+		_packet_index++;
+		
+	} while (!current_connection); // while a packet has no connection get the next one
+
+	// proceed to the next packet
+	_cursor_index = _packet_index - 1;
+	_packet = loadPacket(_cursor_index, 0);
+
+#if MODBUS_GROUP
+	//Pair read packet with following write packet into one function 23 transaction
+	if ( ( (_packet->function == READ_WRITE_MULTIPLE_REGISTERS)
+		|| (_fuse && _packet->function == READ_HOLDING_REGISTERS) )
+		&& (_packet_index < _total_packets) && connected(_packet_index) )
+	{
+		Packet* write = loadPacket(_packet_index, 1);
+		if ( (write->function == PRESET_MULTIPLE_REGISTERS)
+			&& (write->id == _packet->id)
+			&& (13 + write->data * 2 <= BUFFER_SIZE)
+			&& (5 + _packet->data * 2 <= BUFFER_SIZE) )
+		{
+			_group_size = 2;
+			_packet_index++;
+		}
+	}
+
+	//Merge single writes to following addresses of the same slave, see coalesce
+	if ( _coalesce && ( (_packet->function == PRESET_SINGLE_REGISTER)
+		|| (_packet->function == FORCE_SINGLE_COIL) ) )
+	{
+		while ( (_group_size < MAX_GROUP) && (_packet_index < _total_packets) && connected(_packet_index) )
+		{
+			Packet* write = loadPacket(_packet_index, _group_size);
+			if ( (write->function != _packet->function)
+				|| (write->id != _packet->id)
+				|| (write->address != _packet->address + _group_size) )
+				break;
+
+			_group_size++;
+			_packet_index++;
+		}
+	}
+#endif
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Queue one-shot packet
+ * @param: packet to send once and its priority
+ * @return: false if queue is full
+ * @api
+ * @comment: queue is kept sorted, higher priority first and FIFO for same priority
+ */
+bool Modbus::send(Packet *packet, uint8_t priority)
+{
+	unsigned long queued_time = _clock->millis();
+
+	//Packet is already waiting: take it out and insert again with higher priority
+	uint8_t index = findQueued(packet);
+	if (index < _queue_count)
+	{
+		if (priority <= _queue[index].priority)
+			return true;
+
+		queued_time = _queue[index].queued_time;
+		_queue_count--;
+		for (uint8_t i = index; i < _queue_count; i++)
+			_queue[i] = _queue[i + 1];
+	}
+
+	if (_queue_count == _queue_size)
+	{
+		_queue_overflow++;
+		return false;
+	}
+
+	//Find position after all packets with same or higher priority
+	index = _queue_count;
+	while (index > 0 && _queue[index - 1].priority < priority)
+	{
+		_queue[index] = _queue[index - 1];
+		index--;
+	}
+
+	_queue[index].packet = packet;
+	_queue[index].priority = priority;
+	_queue[index].queued_time = queued_time;
+	_queue_count++;
+
+	packet->connection = 1;
+	return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Find one-shot packet in queue
+ * @param: packet
+ * @return: index in queue, or number of queued packets if it is not waiting
+ * @private
+ */
+uint8_t Modbus::findQueued(Packet *packet)
+{
+	uint8_t index;
+	for (index = 0; index < _queue_count; index++)
+	{
+		if (_queue[index].packet == packet)
+			break;
+	}
+	return index;
+}
+
+//-----------------------------------------------------------------------------------
+/* Set storage of submission queue
+ * @param: array of submit slots and number of slots
+ * @return: false if size is not a power of 2 of at least 2
+ * @api
+ * @comment: slots are zeroed, which frees them for lap 0. With one slot the filled
+ *			sequence of a lap is the free sequence of the next lap, so 2 is the minimum
+ */
+bool Modbus::submit_queue(SubmitSlot* slots, uint8_t size)
+{
+	if ( (size < 2) || (size & (size - 1)) )
+		return false;
+
+	memset(slots, 0, size * sizeof(SubmitSlot));
+	_submit = slots;
+	_submit_tail = 0;
+	_submit_head = 0;
+	_submit_size = size;
+	return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Submit a request from a task
+ * @param: request
+ * @return: false if submission queue is full or has no storage
+ * @api
+ * @comment: task wake function of wake() is called
+ */
+bool Modbus::submit(ModbusRequest *request)
+{
+	return enqueue(request, _wake_task);
+}
+
+//-----------------------------------------------------------------------------------
+/* Submit a request from an interrupt
+ * @param: request
+ * @return: false if submission queue is full or has no storage
+ * @api
+ * @comment: interrupt wake function of wake() is called
+ */
+bool Modbus::submitFromISR(ModbusRequest *request)
+{
+	return enqueue(request, _wake_isr);
+}
+
+//-----------------------------------------------------------------------------------
+/* Put a request into submission queue
+ * @param: request and function which wakes the task calling update()
+ * @return: false if submission queue is full or has no storage
+ * @private
+ * @comment: bounded queue with a sequence per slot. A producer takes a position by
+ *			compare and swap of tail, fills its slot, then publishes it by its sequence.
+ *			Sequence is kept relative to slot index, so zeroed slots are free for lap 0
+ */
+bool Modbus::enqueue(ModbusRequest *request, ModbusWake wake)
+{
+	if (_submit_size == 0)
+	{
+		request->status = REQUEST_FAILED;
+		return false;
+	}
+
+	uint8_t position = atomicLoad(&_submit_tail);
+	while (1)
+	{
+		SubmitSlot* slot = &_submit[position & (_submit_size - 1)];
+		uint8_t lap = position & ~(_submit_size - 1);
+		int8_t turn = (int8_t)(atomicLoad(&slot->sequence) - lap);
+
+		if (turn == 0)	//slot is free for this position
+		{
+			if (atomicSwap(&_submit_tail, position, position + 1))
+			{
+				request->status = REQUEST_PENDING;
+				slot->request = request;
+				atomicStore(&slot->sequence, lap + 1);
+				if (wake)
+					wake(_wake_arg);
+				return true;
+			}
+		}
+		else if (turn < 0)	//slot of previous lap is not taken yet
+		{
+			request->status = REQUEST_FAILED;
+			return false;
+		}
+
+		position = atomicLoad(&_submit_tail);
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Move submitted requests into one-shot queue
+ * @param: none
+ * @return: none
+ * @private
+ * @comment: requests stay in submission queue while one-shot queue is full
+ */
+void Modbus::drainSubmitted()
+{
+	if (_submit_size == 0)
+		return;
+
+	while (_queue_count < _queue_size)
+	{
+		SubmitSlot* slot = &_submit[_submit_head & (_submit_size - 1)];
+		uint8_t lap = _submit_head & ~(_submit_size - 1);
+		if (atomicLoad(&slot->sequence) != (uint8_t)(lap + 1))	//not filled yet
+			return;
+
+		ModbusRequest* request = slot->request;
+		atomicStore(&slot->sequence, lap + _submit_size);	//free for next lap
+		_submit_head++;
+
+		send(request->packet, request->priority);
+		request->transaction = _total_request;
+		request->next = _requests;
+		_requests = request;
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Finish requests of a packet
+ * @param: packet and its result
+ * @return: none
+ * @private
+ * @comment: all requests of the same packet are finished by one transaction. A request
+ *			taken after that transaction was sent waits for the next one, which send()
+ *			has queued, so it never gets registers older than its submission
+ */
+void Modbus::finishRequests(Packet *packet, bool success)
+{
+	ModbusRequest** link = &_requests;
+	while (*link)
+	{
+		ModbusRequest* request = *link;
+		if ( (request->packet != packet) || (request->transaction == _total_request) )
+		{
+			link = &request->next;
+			continue;
+		}
+
+		*link = request->next;
+		void (*done)(ModbusRequest*) = request->done;
+		request->status = success ? REQUEST_DONE : REQUEST_FAILED;
+		if (done)
+			done(request);
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Start a block transfer
+ * @param: block
+ * @return: false if a block transfer is already running, function is not a register
+ *			read or write, or range is empty or goes past register 0xFFFF
+ * @api
+ * @comment: chunks are decoded into block registers only by functions 3, 4 and 16
+ */
+bool Modbus::transfer(ModbusBlock *block)
+{
+	if ( _block || (block->count == 0) || ((uint32_t)block->address + block->count > 0x10000) )
+		return false;
+
+	if ( (block->function != READ_HOLDING_REGISTERS) && (block->function != READ_INPUT_REGISTERS) &&
+		 (block->function != PRESET_MULTIPLE_REGISTERS) )
+		return false;
+
+	block->status = REQUEST_PENDING;
+	block->done = 0;
+	block->start = _clock->millis();
+	if (block->share == 0)
+		block->share = 1;
+	else if (block->share > 100)
+		block->share = 100;
+
+	memset(&block->packet, 0, sizeof(block->packet));
+	_block = block;
+	_block_debt = 0;
+	loadChunk();
+	return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Throughput of a block transfer
+ * @param: block
+ * @return: registers per second
+ * @api
+ * @comment: none
+ */
+unsigned long Modbus::transfer_rate(const ModbusBlock *block)
+{
+	unsigned long end = (block->status == REQUEST_PENDING) ? _clock->millis() : block->finish;
+	unsigned long elapsed = end - block->start;
+	if (elapsed == 0)
+		return 0;
+	return (unsigned long)block->done * 1000 / elapsed;
+}
+
+//-----------------------------------------------------------------------------------
+/* Select chunk of block transfer
+ * @param: none
+ * @return: false if there is no block transfer
+ * @private
+ * @comment: a failed chunk is sent again at its next turn
+ */
+bool Modbus::nextChunk()
+{
+	if (_block == NULL)
+		return false;
+
+	_packet = &_block->packet;
+	return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Prepare chunk of block transfer
+ * @param: none
+ * @return: none
+ * @private
+ * @comment: chunk of a block write is filled here once, retries send the same data
+ */
+void Modbus::loadChunk()
+{
+	uint8_t size = (_block->function == PRESET_MULTIPLE_REGISTERS) ? MAX_BLOCK_WRITE : MAX_BLOCK_READ;
+	if (_block->count - _block->done < size)
+		size = _block->count - _block->done;
+
+	Packet* chunk = &_block->packet;
+	construct(chunk, _block->id, _block->function, _block->address + _block->done, size, 0);
+
+	if (_block->function == PRESET_MULTIPLE_REGISTERS)
+		_block->data(_block, chunk->address, _block->registers, size);
+}
+
+//-----------------------------------------------------------------------------------
+/* Finish chunk of block transfer
+ * @param: true if chunk is transferred, false if it reached max retry
+ * @return: none
+ * @private
+ * @comment: decoded chunk of a block read is passed on before the next one is loaded
+ */
+void Modbus::finishChunk(bool success)
+{
+	ModbusBlock* block = _block;
+
+	if (success)
+	{
+		if (block->function != PRESET_MULTIPLE_REGISTERS)
+			block->data(block, block->packet.address, block->registers, block->packet.data);
+
+		block->done += block->packet.data;
+		if (block->done < block->count)
+		{
+			loadChunk();
+			return;
+		}
+	}
+
+	_block = NULL;
+	block->finish = _clock->millis();
+	block->status = success ? REQUEST_DONE : REQUEST_FAILED;
+}
+
+//-----------------------------------------------------------------------------------
+/* Set or clear one bit of a slave register with a single function 22 transaction
+ * @param: function 22 packet, bit number, new value and priority of one-shot packet
+ * @return: false if queue is full
+ * @api
+ * @comment: masks are written into register array of the packet. While the packet is
+ *			still waiting or in progress, changes of other bits are merged into its masks
+ */
+bool Modbus::bit_write(Packet *packet, uint8_t bit, bool value, uint8_t priority)
+{
+	uint16_t* mask = &_register_array[packet->register_start_address];
+	uint16_t bit_mask = (uint16_t)1 << bit;
+
+	//Start from masks which keep all bits of the slave register
+	if ( (findQueued(packet) == _queue_count) && (packet != _oneshot) )
+	{
+		mask[0] = 0xFFFF;	//AND mask
+		mask[1] = 0x0000;	//OR mask
+	}
+
+	mask[0] &= ~bit_mask;
+	if (value)
+		mask[1] |= bit_mask;
+	else
+		mask[1] &= ~bit_mask;
+
+	return send(packet, priority);
+}
+
+void Modbus::status()
+{
+	//Adaptive gap is checked before the next request is sent, see gapFinished
+	unsigned char pollingFinished = (_gap_mode == GAP_ADAPTIVE) || (_clock->millis() - _delayStart) > _polling;
+
+	if (_response_flag && pollingFinished ) //if slave responsed error or success
+	{
+		_response_flag = false;
+		_transmission_ready_flag = true;
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Check gap before sending selected packet
+ * @param: none
+ * @return: true if packet can be sent
+ * @private
+ * @comment: in adaptive mode bus need to be silent for 3.5 character times plus the
+ *			turnaround guard of addressed slave. Polling is the minimum time between
+ *			two requests
+ */
+bool Modbus::gapFinished()
+{
+	if (_gap_mode != GAP_ADAPTIVE)
+		return true;
+
+	if ( (_clock->millis() - _request_start) < (unsigned long)_polling )
+		return false;
+
+	return (_clock->micros() - _bus_idle) >= (unsigned long)T3_5 + turnaround(_packet->id);
+}
+
+//-----------------------------------------------------------------------------------
+/* Size of response to current request
+ * @param: none
+ * @return: size of response frame with CRC
+ * @private
+ * @comment: an exception response is shorter, it is 5 bytes
+ */
+uint8_t Modbus::responseSize()
+{
+	switch (_request_function)
+	{
+		case READ_COIL_STATUS:
+		case READ_INPUT_STATUS:
+			return 5 + (_packet->data + 7) / 8;
+		case READ_HOLDING_REGISTERS:
+		case READ_INPUT_REGISTERS:
+		case READ_WRITE_MULTIPLE_REGISTERS:
+			return 5 + _packet->data * 2;
+		case MASK_WRITE_REGISTER:
+			return 10;
+		default:	//functions 5, 6, 15 & 16 echo address and data
+			return 8;
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Tell master that bytes were received on its port
+ * @param: none
+ * @return: none
+ * @api
+ * @comment: it may run in an interrupt, it only reads the port and calls interrupt
+ *			wake function
+ */
+void Modbus::received()
+{
+	_rx_notified = true;
+
+	if (!_rx_started || (*_modbusPort).available() >= _response_size)
+	{
+		_rx_started = true;
+		if (_wake_isr)
+			_wake_isr(_wake_arg);
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Time update() has nothing to do
+ * @param: none
+ * @return: time in microsecond, 0 if update() should be called now
+ * @api
+ * @comment: an idle master with no packet to send still wakes once per timeout
+ */
+unsigned long Modbus::idle()
+{
+	unsigned long elapsed;
+
+	if (_transmission_ready_flag)
+	{
+		if (!_gap_hold)
+			return _bus_empty ? _timeout * 1000UL : 0;
+
+		//Adaptive gap, minimum time between requests and silence on the bus
+		unsigned long wait = 0;
+		elapsed = _clock->millis() - _request_start;
+		if (elapsed < (unsigned long)_polling)
+			wait = (_polling - elapsed) * 1000UL;
+
+		unsigned long silence = (unsigned long)T3_5 + turnaround(_packet->id);
+		elapsed = _clock->micros() - _bus_idle;
+		if (elapsed < silence && silence - elapsed > wait)
+			wait = silence - elapsed;
+		return wait;
+	}
+
+	if (_response_flag)	//polling after response, see status
+	{
+		elapsed = _clock->millis() - _delayStart;
+		if (_gap_mode == GAP_ADAPTIVE || elapsed > (unsigned long)_polling)
+			return 0;
+		return (_polling - elapsed + 1) * 1000UL;
+	}
+
+	//Waiting for response, it is read when it is complete, see getPacket
+	unsigned long frame = (unsigned long)_response_size * _byte_time;
+	if ((*_modbusPort).available() > 0)
+	{
+		elapsed = _clock->micros() - _rx_first;
+		if (!_rx_pending || elapsed >= frame || (*_modbusPort).available() >= _response_size)
+			return 0;
+		return frame - elapsed;
+	}
+
+	if (_manual_request)
+		return frame;
+
+	elapsed = _clock->millis() - _delayStart;
+	if (elapsed > (unsigned long)_timeout)
+		return 0;
+	unsigned long remaining = (_timeout - elapsed + 1) * 1000UL;
 
-	do
-	{		
-		if (packet_index == _total_packets) // wrap around to the beginning
-			packet_index = 0;
-	
-		// proceed to the next packet
-		_packet = &_packet_array[packet_index];
-	
-		// get the current connection status
-		current_connection = _packet->connection;
-	
-		if (!current_connection)
-		{		
-			// If all the connection attributes are false return
-			// immediately to the main sketch
-			if (++failed_connections == _total_packets)
-				return;
-		}
-	
-		packet_index++;
-		
-	} while (!current_connection); // while a packet has no connection get the next one
-	constructPacket();
+	//Without received() port is checked once per frame time
+	if (!_rx_notified && frame < remaining)
+		return frame;
+	return remaining;
 }
 
-void Modbus::update()
+//-----------------------------------------------------------------------------------
+/* Find turnaround entry of a slave
+ * @param: slave ID, create a new entry if slave has none
+ * @return: entry, NULL if slave has none
+ * @private
+ * @comment: when table is full the entry with smallest guard is taken over
+ */
+Turnaround* Modbus::findTurnaround(uint8_t id, bool create)
 {
-	if (_transmission_ready_flag)
+	if (id == 0)	//broadcast, no slave answers
+		return NULL;
+
+	Turnaround* entry = NULL;
+	for (uint8_t i = 0; i < _turnaround_size; i++)
 	{
-		static uint8_t packet_index = 0;
-		unsigned int failed_connections = 0;
-	
-		unsigned char current_connection;
-	
-		do
-		{		
-			if (packet_index == _total_packets) // wrap around to the beginning
-				packet_index = 0;
-		
-			// proceed to the next packet
-			_packet = &_packet_array[packet_index];
-		
-			// get the current connection status
-			current_connection = _packet->connection;
-		
-			if (!current_connection)
-			{		
-				// If all the connection attributes are false return
-				// immediately to the main sketch
-				if (++failed_connections == _total_packets)
-					return;
-			}
-		
-			packet_index++;
-			
-		} while (!current_connection); // while a packet has no connection get the next one
-		
-		constructPacket();
+		if (_turnaround[i].id == id)
+			return &_turnaround[i];
+		if (entry == NULL || _turnaround[i].id == 0 || 
+			(entry->id != 0 && _turnaround[i].guard < entry->guard))
+			entry = &_turnaround[i];
 	}
 
-	//check response packet
-	checkPacket();
+	if (!create || entry == NULL)
+		return NULL;
 
-	status();
+	entry->id = id;
+	entry->guard = 0;
+	return entry;
 }
 
-void Modbus::status()
+//-----------------------------------------------------------------------------------
+/* Learn turnaround guard of a slave
+ * @param: slave ID, true if its transaction failed
+ * @return: none
+ * @private
+ * @comment: only a missing response is a failure, a slave which answers has heard the
+ *			request. Guard starts at 3.5 character times and doubles on each failure. It
+ *			shrinks by 1/256 on each answer, so a slow slave costs a retry only once in a
+ *			while. A slave which fails with MAX_GUARD is not a turnaround problem, its entry
+ *			is freed
+ */
+void Modbus::learnTurnaround(uint8_t id, bool failed)
 {
-	unsigned char pollingFinished = (millis() - _delayStart) > _polling;
+	if (_gap_mode != GAP_ADAPTIVE)
+		return;
 
-	if (_response_flag && pollingFinished ) //if slave responsed error or success
+	Turnaround* entry = findTurnaround(id, failed);
+	if (entry == NULL)
+		return;
+
+	if (failed)
 	{
-		_response_flag = false;
-		_transmission_ready_flag = true;
+		if (entry->guard == 0)
+			entry->guard = T3_5;
+		else if (entry->guard == MAX_GUARD)
+			entry->id = 0;
+		else if (entry->guard >= MAX_GUARD / 2)
+			entry->guard = MAX_GUARD;
+		else
+			entry->guard *= 2;
+	}
+	else
+	{
+		entry->guard -= (entry->guard >> 8) + 1;
+		if (entry->guard == 0)	//slave does not need a guard anymore
+			entry->id = 0;
 	}
 }
 
+//-----------------------------------------------------------------------------------
+/* Return learned turnaround guard of a slave
+ * @param: slave ID
+ * @return: time in microsecond
+ * @api
+ * @comment: none
+ */
+uint16_t Modbus::turnaround(uint8_t id)
+{
+	Turnaround* entry = findTurnaround(id, false);
+	return entry ? entry->guard : 0;
+}
+
 //-----------------------------------------------------------------------------------
 /* Request Check validity of packet and process the result
  * @param: none
@@ -163,79 +852,105 @@ void Modbus::checkPacket()
 	if ( buffer == 0 )
 		return;
 
-#if DEBUG_UART
-	print(F("Response: "));
-	for (uint8_t i=0;i<buffer;i++)
+	processPacket(buffer);
+}
+
+//-----------------------------------------------------------------------------------
+/* Check validity of received frame and process the result
+ * @param: frame's size
+ * @return: none
+ * @private
+ */
+void Modbus::processPacket(uint8_t buffer)
+{
+
+	//Frame need to hold at least ID, function, one byte and CRC
+	if ( (buffer < 5) || (buffer > BUFFER_SIZE) )
+	{
+		trace(TRACE_FRAME, buffer);
+		packetError();
+		return;
+	}
+
+	uint16_t received_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
+	uint16_t calculated_crc = calculateCRC(buffer - 2);
+
+	if ( calculated_crc != received_crc )	//verify checksum
 	{
-		print(frame[i]);
+		trace(TRACE_CRC, received_crc);
+		packetError();
+		return;
 	}
-	print('\t');
-#endif
 
-	uint8_t stt = 0;
+	//Response need to answer the requested function
+	if ( (frame[1] & 0x7F) != _request_function )
+	{
+		trace(TRACE_FUNCTION, frame[1]);
+		packetError();
+		return;
+	}
 
 	//Check exception response. Slave with OR with 0x80 if exception exists
 	if ( (frame[1] & 0x80) == 0x80 )
 	{	
-		println(F("Packet errors"));
-		switch(frame[2]) //3rd is the exception code
-		{
-			case ILLEGAL_FUNCTION:
-				println(F("Illegal function or not support"));
-				break;
-			case ILLEGAL_DATA_VALUE:
-				println(F("Illegal Value"));
-				break;
-			case ILLEGAL_DATA_ADDRESS:
-				println(F("Illegal data address"));
-				break;
-			default:
-				println(F("Misc exception"));
-		}
+		trace(TRACE_EXCEPTION, frame[2]);	//3rd is the exception code
+#if MODBUS_STATISTICS
+		for (uint8_t i = 0; i < _group_size; i++)
+			_packet[i].exception_errors++;
+#endif
+		learnTurnaround(_packet->id, false);	//slave heard the request
 		packetError();
 		return;
 	}//check exception
 
-	uint16_t received_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
-	uint16_t calculated_crc = calculateCRC(buffer - 2);
-
-	if ( calculated_crc == received_crc )	//verify checksum
+	//Check frame size of response
+	uint8_t expected_size;
+	switch( frame[1] )
 	{
-		#if DEBUG_UART
-		print("CRC! ");
-		#endif
-		//Check packet functions
-		switch( frame[1] )
-		{
-			case READ_COIL_STATUS:
-	        case READ_INPUT_STATUS:
-	        	process_F1_F2();
-	        	break;
-	        case READ_INPUT_REGISTERS:
-	        case READ_HOLDING_REGISTERS:
-	        	process_F3_F4();
-	        	break;
-			case FORCE_SINGLE_COIL:
-			case PRESET_SINGLE_REGISTER:
-	        case FORCE_MULTIPLE_COILS:
-	        case PRESET_MULTIPLE_REGISTERS:
-	        	process_F5_F6_F15_F16();
-	        	break;
-	        default: // illegal function returned
-	        	packetError();
-	        break;   
-		}
+		case READ_COIL_STATUS:
+		case READ_INPUT_STATUS:
+		case READ_INPUT_REGISTERS:
+		case READ_HOLDING_REGISTERS:
+		case READ_WRITE_MULTIPLE_REGISTERS:
+			expected_size = 5 + frame[2];	//ID, function, byte count, data, CRC
+			break;
+		case MASK_WRITE_REGISTER:
+			expected_size = 10;	//echo of request
+			break;
+		default:
+			expected_size = 8;	//echo of address and data
+	}
 
-		return;
-	}//CRC check
-	else
+	if ( buffer != expected_size )
 	{
+		trace(TRACE_LENGTH, buffer);
 		packetError();
-		println(F("CRC errors"));
 		return;
 	}
 
-
+	//Check packet functions
+	switch( frame[1] )
+	{
+		case READ_COIL_STATUS:
+        case READ_INPUT_STATUS:
+        	process_F1_F2();
+        	break;
+        case READ_INPUT_REGISTERS:
+        case READ_HOLDING_REGISTERS:
+        case READ_WRITE_MULTIPLE_REGISTERS:
+        	process_F3_F4();
+        	break;
+		case FORCE_SINGLE_COIL:
+		case PRESET_SINGLE_REGISTER:
+        case FORCE_MULTIPLE_COILS:
+        case PRESET_MULTIPLE_REGISTERS:
+        case MASK_WRITE_REGISTER:
+        	process_F5_F6_F15_F16();
+        	break;
+        default: // illegal function returned
+        	packetError();
+        break;   
+	}
 }
 
 //-----------------------------------------------------------------------------------
@@ -248,15 +963,9 @@ void Modbus::process_F1_F2()
 {
 	//Serial.println("process_F1_F2");
 	// packet->data for function 1 & 2 is actually the number of boolean points
-  unsigned char no_of_registers = _packet->data / 16;
-  unsigned char number_of_bytes = no_of_registers * 2; 
-       
-  // if the number of points dont fit in even 2byte amounts (one register) then use another register and pad 
-  if (_packet->data % 16 > 0) 
-  {
-    no_of_registers++;
-    number_of_bytes++;
-  }
+  // 8 points per byte, 2 bytes per register. Last byte and register are padded
+  unsigned char number_of_bytes = (_packet->data + 7) / 8;
+  unsigned char no_of_registers = (number_of_bytes + 1) / 2;
              
   if (frame[2] == number_of_bytes) // check number of bytes returned
   { 
@@ -273,7 +982,12 @@ void Modbus::process_F1_F2()
         bytes_processed++;
         index += 2;
       }
-      _register_array[_packet->register_start_address + i] = temp;
+      uint16_t address = _packet->register_start_address + i;
+      if (_register_array[address] != temp)
+      {
+        _register_array[address] = temp;
+        markChanged(address);
+      }
     }
     packetSuccess(); 
   }
@@ -282,7 +996,7 @@ void Modbus::process_F1_F2()
 }
 
 //-----------------------------------------------------------------------------------
-/* Request Process packet of function 3 and function 4
+/* Request Process packet of function 3, function 4 and function 23
  * @param: none
  * @return: Holding register in 2 bytes
  * @private
@@ -292,12 +1006,31 @@ void Modbus::process_F3_F4()
 	//Frame[2] is number of bytes returned in uint16_t = 2 bytes
 	if ( frame[2] == ( _packet->data * 2) )
 	{
+		//Chunk of block transfer is decoded into its own registers
+		bool chunk = blockChunk();
+		uint16_t* registers = chunk ? _block->registers : &_register_array[_packet->register_start_address];
+
+		//Only changed registers are written, range of changes selects points to decode
+		uint8_t first = _packet->data;
+		uint8_t last = 0;
 		uint8_t index = 3; //3nd bytes
 		for (uint8_t i=0;i < _packet->data; i++ )
 		{
-			_register_array[i] = ( frame[index] << 8) | frame[index+1];
+			uint16_t value = ( frame[index] << 8) | frame[index+1];
+			if (registers[i] != value)
+			{
+				registers[i] = value;
+				if (first > i)
+					first = i;
+				last = i;
+				if (!chunk)
+					markChanged(_packet->register_start_address + i);
+			}
 			index += 2;	//increase 2 bytes
 		}
+		if (!chunk && first <= last)
+			decodePoints(_packet->register_start_address, _packet->data, 
+				_packet->register_start_address + first, _packet->register_start_address + last + 1);
 		packetSuccess();
 	}
 	else
@@ -305,7 +1038,7 @@ void Modbus::process_F3_F4()
 }
 
 //-----------------------------------------------------------------------------------
-/* Request Process packet of function 5,6,15,16
+/* Request Process packet of function 5,6,15,16,22
  * @param: none
  * @return: none
  * @private
@@ -314,16 +1047,138 @@ void Modbus::process_F3_F4()
 void Modbus::process_F5_F6_F15_F16()
 {
 	//Serial.println("process_F5_F6");
-	// The repsonse of functions 5,6,15 & 16 are just an echo of the query
+	// The repsonse of functions 5,6,15,16 & 22 are just an echo of the query
   unsigned int recieved_address = ((frame[2] << 8) | frame[3]);
   unsigned int recieved_data = ((frame[4] << 8) | frame[5]);
 		
-  if ((recieved_address == _packet->address) && (recieved_data == _packet->data))
+  //Merged single writes are echoed as function 16 or 15, data is number of packets
+  unsigned int expected_data = coalesced() ? _group_size : _packet->data;
+  if ((recieved_address == _packet->address) && (recieved_data == expected_data))
     packetSuccess();
   else
     packetError();
 }
 
+//-----------------------------------------------------------------------------------
+/* Decode typed points covered by registers just read
+ * @param: first register and number of registers read, range of changed registers
+ * @return: none
+ * @private
+ * @comment: only points which lie completely inside the registers read and have a
+ *			changed register are decoded. Notify function gets points whose target changed
+ */
+void Modbus::decodePoints(uint16_t register_start, uint16_t total_registers, uint16_t changed_start, uint16_t changed_end)
+{
+	uint16_t register_end = register_start + total_registers;
+
+	for (PointMap* map = _point_maps; map; map = map->next)
+	{
+		if (map->register_start >= changed_end)
+			continue;
+
+		for (uint8_t j = 0; j < map->total_points; j++)
+		{
+			const Point* point = &map->points[j];
+			uint16_t point_start = map->register_start + point->offset;
+			uint16_t point_end = point_start + point->size;
+
+			if ( (point_start < register_start) || (point_end > register_end) )
+				continue;
+			if ( (point_end <= changed_start) || (point_start >= changed_end) )
+				continue;
+
+			if (point->decode(&_register_array[point_start], point) && _point_callback)
+				_point_callback(point);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------------
+/* Map typed points onto register array
+ * @param: map, its points, number of points and first register of map
+ * @return: none
+ * @api
+ * @comment: new map is linked after the others, so points are decoded in mapped order
+ */
+void Modbus::map(PointMap* map, const Point* points, uint8_t total_points, uint16_t register_start)
+{
+	PointMap** link = &_point_maps;
+	while (*link && *link != map)
+		link = &(*link)->next;
+
+	if (*link == NULL)
+	{
+		map->next = NULL;
+		*link = map;
+	}
+
+	map->points = points;
+	map->total_points = total_points;
+	map->register_start = register_start;
+
+	//Targets start from current registers, later reads only decode changes
+	for (uint8_t i = 0; _register_array && i < total_points; i++)
+		points[i].decode(&_register_array[register_start + points[i].offset], &points[i]);
+}
+
+//-----------------------------------------------------------------------------------
+/* Mark registers changed by reads in a bitmap
+ * @param: bitmap and number of registers to watch
+ * @return: none
+ * @api
+ * @comment: none
+ */
+void Modbus::watch(ChangeWord* changed, uint16_t total_registers)
+{
+	_total_watched = 0;
+	_changed = changed;
+	if (changed == NULL)
+		return;
+
+	memset(changed, 0, CHANGE_WORDS(total_registers) * sizeof(ChangeWord));
+	_total_watched = total_registers;
+}
+
+//-----------------------------------------------------------------------------------
+/* Take next changed register
+ * @param: index of register to start from, set to the changed register
+ * @return: false if no register from index on has changed
+ * @api
+ * @comment: a word without changes is skipped with one compare, on 32 bit targets
+ *			the lowest changed bit is found with count trailing zeros
+ */
+bool Modbus::next_change(uint16_t* index)
+{
+	uint16_t i = *index;
+	while (i < _total_watched)
+	{
+		ChangeWord* word = &_changed[i / CHANGE_BITS];
+		ChangeWord bits = *word >> (i % CHANGE_BITS);
+		if (bits == 0)
+		{
+			i = (i / CHANGE_BITS + 1) * CHANGE_BITS;
+			continue;
+		}
+
+#if CHANGE_BITS == 32 && defined(__GNUC__)
+		i += __builtin_ctz(bits);
+#else
+		while ( !(bits & 1) )
+		{
+			bits >>= 1;
+			i++;
+		}
+#endif
+		if (i >= _total_watched)
+			break;
+
+		*word &= ~((ChangeWord)1 << (i % CHANGE_BITS));
+		*index = i;
+		return true;
+	}
+	return false;
+}
+
 //-----------------------------------------------------------------------------------
 /* Request report successful packets
  * @param: none
@@ -333,10 +1188,37 @@ void Modbus::process_F5_F6_F15_F16()
  */
 void Modbus::packetSuccess()
 {
-	_packet->successful_requests++;
-	_packet->retries = 0;
+	for (uint8_t i = 0; i < _group_size; i++)
+	{
+#if MODBUS_STATISTICS
+		_packet[i].successful_requests++;
+#endif
+		_packet[i].retries = 0;
+	}
+
+	if (_packet == _oneshot)	//one-shot packet is done
+		_oneshot = NULL;
+
+	learnTurnaround(_packet->id, false);
+
+	storePackets();
+
+	_response_ok = true;
 	_response_flag = true;	//got response
-	_delayStart = millis();
+	_delayStart = _clock->millis();
+
+	if (blockChunk())
+	{
+		finishChunk(true);
+		return;
+	}
+
+	for (uint8_t i = 0; i < _group_size; i++)
+	{
+		finishRequests(&_packet[i], true);
+		if (_callback)
+			_callback(&_packet[i], true);
+	}
 }
 
 //-----------------------------------------------------------------------------------
@@ -348,22 +1230,65 @@ void Modbus::packetSuccess()
  */
 void Modbus::packetError()
 {
+	_response_ok = false;
 	_response_flag = true;	//got response
-
-	_packet->retries++;
-	_packet->failed_requests++;
 	_total_fail++;
+
+	//retries of a packet table are kept in 7 bits of PacketState
+	uint8_t retry_count = _retry_count;
+	if ( (_packet == _cursor) && (retry_count > MAX_RETRY) )
+		retry_count = MAX_RETRY;
+
+	uint8_t given_up = 0;	//packets which reached max retry
+	for (uint8_t i = 0; i < _group_size; i++)
+	{
+		Packet* packet = &_packet[i];
+		packet->retries++;
+#if MODBUS_STATISTICS
+		packet->failed_requests++;
+#endif
 	
-	// if the number of retries have reached the max number of retries 
-    // allowable, stop requesting the specific packet
-    if (_packet->retries == _retry_count)
+		if (packet->retries < retry_count)
+		{
+			trace(TRACE_RETRY, packet->retries);
+		}
+
+		// if the number of retries have reached the max number of retries 
+	    // allowable, stop requesting the specific packet
+	    if (packet->retries == retry_count)
+		{
+			trace(TRACE_GIVE_UP, packet->retries);
+	    	packet->connection = 0;
+			packet->retries = 0;
+			given_up |= 1 << i;
+
+			//guard of a dead slave is not learned
+			Turnaround* entry = findTurnaround(packet->id, false);
+			if (entry)
+				entry->id = 0;
+
+			if (packet == _oneshot)	//give up one-shot packet
+				_oneshot = NULL;
+		}
+	}
+	storePackets();
+	_delayStart = _clock->millis();
+
+	if (blockChunk())
 	{
-		println("Max retry");
-    	_packet->connection = 0;
-		_packet->retries = 0;
+		if (given_up)
+			finishChunk(false);
+		return;
+	}
+
+	for (uint8_t i = 0; i < _group_size; i++)
+	{
+		if ( !(given_up & (1 << i)) )
+			continue;
+		finishRequests(&_packet[i], false);
+		if (_callback)
+			_callback(&_packet[i], false);
 	}
-	_delayStart = millis();
-	
 }
 //-----------------------------------------------------------------------------------
 /* Request Cunstruct packet to send
@@ -377,30 +1302,52 @@ void Modbus::constructPacket()
 	//Disable next transmission until get response packet or timeout
 	_transmission_ready_flag = false;
 
-	_packet->requests++;
+#if MODBUS_STATISTICS
+	for (uint8_t i = 0; i < _group_size; i++)
+		_packet[i].requests++;
+#endif
 	_total_request++;	//calculate total packets are requested
 
 	//Modbus Application Protocol v1.13b
 	frame[0] = _packet->id;
 	frame[1] = _packet->function;
+	if (coalesced())
+		frame[1] = (_packet->function == PRESET_SINGLE_REGISTER) ? PRESET_MULTIPLE_REGISTERS : FORCE_MULTIPLE_COILS;
+	else if (_group_size == 2)
+		frame[1] = READ_WRITE_MULTIPLE_REGISTERS;	//fused read/write pair
+	else if (_packet->function == READ_WRITE_MULTIPLE_REGISTERS)
+		frame[1] = READ_HOLDING_REGISTERS;	//no write packet to pair with, just read
+	_request_function = frame[1];
+	_response_size = responseSize();
 	frame[2] = _packet->address >> 8; //Address Hi
 	frame[3] = _packet->address & 0xFF; //Address Lo
 
 	//If packet is single regiser, data is what it is
 	if ( _packet->function == PRESET_SINGLE_REGISTER ){
+		for (uint8_t i = 0; i < _group_size; i++)
+			_packet[i].data = _register_array[_packet[i].register_start_address];
+	}
+
+	//Mask write register, data is AND mask
+	if ( _packet->function == MASK_WRITE_REGISTER ){
 		_packet->data = _register_array[_packet->register_start_address];
 	}
 
 	//2 bytes address
-	frame[4] = _packet->data >> 8; 	//total registers Hi
-	frame[5] = _packet->data & 0xFF;	//total registers Lo
+	uint16_t data = coalesced() ? _group_size : _packet->data;	//merged writes, number of packets
+	frame[4] = data >> 8; 	//total registers Hi
+	frame[5] = data & 0xFF;	//total registers Lo
 
 	//Frame size for function code 3, 4 & 6 = 8
 	uint8_t frameSize;
-	if (_packet->function == PRESET_MULTIPLE_REGISTERS) 
+	if (frame[1] == READ_WRITE_MULTIPLE_REGISTERS)
+		frameSize = construct_F23();
+	else if (frame[1] == PRESET_MULTIPLE_REGISTERS) 
 		frameSize = construct_F16();
-	else if (_packet->function == FORCE_MULTIPLE_COILS)
+	else if (frame[1] == FORCE_MULTIPLE_COILS)
 		frameSize = construct_F15();
+	else if (_packet->function == MASK_WRITE_REGISTER)
+		frameSize = construct_F22();
 	else // else functions 1,2,3,4,5 & 6 is assumed. They all share the exact same request format.
     	frameSize = 8; // the request is always 8 bytes in size for the above mentioned functions.
 
@@ -409,12 +1356,15 @@ void Modbus::constructPacket()
 	frame[frameSize - 2] = crc16 >> 8;	//High byte of CRC
 	frame[frameSize - 1] = crc16 & 0xFF;	//Low byte of CRC
 
-#if DEBUG_UART
-	print("Request:  ");
-	for (uint8_t i=0;i<frameSize;i++)
-		print(frame[i]);
-	println();
-#endif
+	//Bus time of block transfer against other packets, see nextPacket
+	if (_block)
+	{
+		uint8_t bytes = frameSize + _response_size;
+		if (blockChunk())
+			_block_debt -= (long)bytes * (100 - _block->share);
+		else
+			_block_debt += (long)bytes * _block->share;
+	}
 
 	//Send packet frame to slave
 	sendPacket(frameSize);
@@ -425,21 +1375,28 @@ void Modbus::constructPacket()
  * @param: none
  * @return: none
  * @private
- * @comment: none
+ * @comment: merged function 5 packets give one coil each, see coalesce
  */
 uint8_t Modbus::construct_F15()
 {
+	if (coalesced())
+	{
+		uint8_t no_of_bytes = (_group_size + 7) / 8;
+		frame[6] = no_of_bytes;
+		memset(&frame[7], 0, no_of_bytes);
+		for (uint8_t i = 0; i < _group_size; i++)
+		{
+			if (_packet[i].data == COIL_ON)
+				frame[7 + i / 8] |= 1 << (i % 8);
+		}
+		return 9 + no_of_bytes;
+	}
+
 	// function 15 coil information is packed LSB first until the first 16 bits are completed
   // It is received the same way..
-  uint8_t no_of_registers = _packet->data / 16;
-  uint8_t no_of_bytes = no_of_registers * 2; 
-	
-  // if the number of points dont fit in even 2byte amounts (one register) then use another register and pad 
-  if (_packet->data % 16 > 0) 
-  {
-    no_of_registers++;
-    no_of_bytes++;
-  }
+  // 8 coils per byte, 2 bytes per register. Last byte and register are padded
+  uint8_t no_of_bytes = (_packet->data + 7) / 8;
+  uint8_t no_of_registers = (no_of_bytes + 1) / 2;
 	
   frame[6] = no_of_bytes;
   uint8_t bytes_processed = 0;
@@ -468,10 +1425,21 @@ uint8_t Modbus::construct_F15()
  * @param: none
  * @return: size of packet
  * @private
- * @comment: none
+ * @comment: merged function 6 packets give one register each, see coalesce
  */
 uint8_t Modbus::construct_F16()
 {
+	if (coalesced())
+	{
+		frame[6] = _group_size * 2;
+		for (uint8_t i = 0; i < _group_size; i++)
+		{
+			frame[7 + i * 2] = _packet[i].data >> 8;
+			frame[8 + i * 2] = _packet[i].data & 0xFF;
+		}
+		return 9 + _group_size * 2;
+	}
+
 	uint8_t no_of_bytes = _packet->data * 2; 
     
 	// first 6 bytes of the array + no_of_bytes + 2 bytes CRC 
@@ -479,10 +1447,13 @@ uint8_t Modbus::construct_F16()
 	uint8_t index = 7; // user data starts at index 7
 	uint8_t no_of_registers = _packet->data;
 	uint16_t temp;
+
+	//Chunk of block transfer is sent from its own registers
+	uint16_t* registers = blockChunk() ? _block->registers : &_register_array[_packet->register_start_address];
 		
   	for (uint8_t i = 0; i < no_of_registers; i++)
   	{
-	    temp = _register_array[_packet->register_start_address + i]; // get the data
+	    temp = registers[i]; // get the data
 	    frame[index] = temp >> 8;
 	    index++;
 	    frame[index] = temp & 0xFF;
@@ -493,23 +1464,97 @@ uint8_t Modbus::construct_F16()
 }
 
 //-----------------------------------------------------------------------------------
-/* Intitialize Modbus config
+/* Modifies a holding register with AND mask and OR mask
+ * @param: none
+ * @return: size of packet
+ * @private
+ * @comment: result = (current AND and_mask) OR (or_mask AND NOT and_mask).
+ *			AND mask is already in frame[4], frame[5]
+ */
+uint8_t Modbus::construct_F22()
+{
+	uint16_t or_mask = _register_array[_packet->register_start_address + 1];
+	frame[6] = or_mask >> 8;	//OR mask Hi
+	frame[7] = or_mask & 0xFF;	//OR mask Lo
+	return 10;	// first 8 bytes of the array + 2 bytes CRC
+}
+
+//-----------------------------------------------------------------------------------
+/* Writes a sequence of holding registers then reads a sequence of holding registers
+ * @param: none
+ * @return: size of packet
+ * @private
+ * @comment: read part is _packet, write part is the packet after it
+ */
+uint8_t Modbus::construct_F23()
+{
+	Packet* write = _packet + 1;
+	uint8_t no_of_bytes = write->data * 2;
+
+	frame[6] = write->address >> 8;	//write address Hi
+	frame[7] = write->address & 0xFF;	//write address Lo
+	frame[8] = write->data >> 8;	//total registers to write Hi
+	frame[9] = write->data & 0xFF;	//total registers to write Lo
+	frame[10] = no_of_bytes;	//number of bytes
+	uint8_t index = 11;	//user data starts at index 11
+	uint16_t temp;
+
+	for (uint8_t i = 0; i < write->data; i++)
+	{
+		temp = _register_array[write->register_start_address + i]; // get the data
+		frame[index] = temp >> 8;
+		index++;
+		frame[index] = temp & 0xFF;
+		index++;
+	}
+	uint8_t frameSize = (13 + no_of_bytes); // first 11 bytes of the array + 2 bytes CRC + noOfBytes 
+	return frameSize;
+}
+
+//-----------------------------------------------------------------------------------
+/* Intitialize Modbus config
+ * @param: Modbus config
+ * 		- Mobus port
+ *		- baud: baurate of transmission
+ * 		- timeout: time to wait for returned packet
+ * 		- polling:	time between two packet
+ *		- retry: how many time packet is resent if it was failed
+ *		- TxEnablePin: for RS485 only, pin to enable transmission
+ * @return: size of packet
+ * @private
+ * @comment: none
+ */
+#if defined(__SAM3X8E__)
+	void Modbus::begin(USARTClass* modbusPort, long baud, uint8_t byteFormat,long timeout, long polling, uint8_t retry, uint8_t TxEnablePin)
+#else
+	void Modbus::begin(HardwareSerial* modbusPort, long baud, uint8_t byteFormat, long timeout, long polling, uint8_t retry, uint8_t TxEnablePin)
+#endif
+{
+	_byteFormat = byteFormat;
+#if defined(__SAM3X8E__)
+	(*modbusPort).begin(baud,SERIAL_8E1);
+#else
+	(*modbusPort).begin(baud,_byteFormat);
+#endif
+
+	begin((Stream*)modbusPort, baud, timeout, polling, retry, TxEnablePin);
+}
+
+//-----------------------------------------------------------------------------------
+/* Intitialize Modbus config on any stream, e.g. a simulated bus
  * @param: Modbus config
- * 		- Mobus port
- *		- baud: baurate of transmission
+ * 		- Mobus port: stream which is already started by caller
+ *		- baud: baurate of transmission, used to calculate frame timing
  * 		- timeout: time to wait for returned packet
  * 		- polling:	time between two packet
- *		- retry: how many time packet is resent if it was failed
+ *		- retry: how many time packet is resent if it was failed, packet table
+ *		  configured by PacketConfig takes up to MAX_RETRY
  *		- TxEnablePin: for RS485 only, pin to enable transmission
- * @return: size of packet
- * @private
+ * @return: none
+ * @api
  * @comment: none
  */
-#if defined(__SAM3X8E__)
-	void Modbus::begin(USARTClass* modbusPort, long baud, uint8_t byteFormat,long timeout, long polling, uint8_t retry, uint8_t TxEnablePin)
-#else
-	void Modbus::begin(HardwareSerial* modbusPort, long baud, uint8_t byteFormat, long timeout, long polling, uint8_t retry, uint8_t TxEnablePin)
-#endif
+void Modbus::begin(Stream* modbusPort, long baud, long timeout, long polling, uint8_t retry, uint8_t TxEnablePin)
 {
 
 	/*
@@ -542,21 +1587,33 @@ uint8_t Modbus::construct_F16()
 	
 	_frame_delay = T1_5 * 2;
 
+	_byte_time = 11000000/_baud;	//11 bits with parity or 2 stop bits
+
+	//Silence between two frames, 1750us above 19200 baud
+	if (_baud > 19200)
+		T3_5 = 1750;
+	else
+		T3_5 = 35000000/_baud;
+	clearTurnaround();
+	_gap_hold = false;
+
 	_modbusPort = modbusPort;
 
-	_byteFormat = byteFormat;
 	_timeout = timeout;
 	_polling = polling;
 	_retry_count = retry;
 	_TxEnablePin = TxEnablePin;
-#if defined(__SAM3X8E__)
-	(*_modbusPort).begin(_baud,SERIAL_8E1);
-#else
-	(*_modbusPort).begin(_baud,_byteFormat);
-#endif
 
 	TxEnableConfig();
 
+	//Scan starts at first packet and bus is silent from now, so a restarted run
+	//behaves like the first one
+	_packet_index = 0;
+	_response_flag = false;
+	_rx_pending = false;
+	_bus_idle = _clock->micros();
+	_request_start = _clock->millis() - _polling;
+
 	_transmission_ready_flag = true; //start 1st time
 }
 
@@ -572,10 +1629,13 @@ uint8_t Modbus::construct_F16()
  */
 void Modbus::configure(Packet* packets, uint16_t total_packets, uint16_t* register_array)
 {
+	_packet_config = NULL;
+	_packet_state = NULL;
 	_packet_array = packets;
 	_register_array = register_array;
 	_total_packets = total_packets;
 	_manual_request = false;
+	_gap_hold = false;
 }
 
 //-----------------------------------------------------------------------------------
@@ -590,10 +1650,303 @@ void Modbus::configure(Packet* packets, uint16_t total_packets, uint16_t* regist
  */
 void Modbus::configure_manual(Packet* packets, uint16_t total_packets, uint16_t* register_array)
 {
+	_packet_config = NULL;
+	_packet_state = NULL;
 	_packet_array = packets;
 	_register_array = register_array;
 	_total_packets = total_packets;
 	_manual_request = true;
+	_gap_hold = false;
+}
+
+//-----------------------------------------------------------------------------------
+/* Intitialize packet table
+ * @param: Packet table and register of master to hold data
+ *		- config: config of packets in SRAM
+ *		- state: runtime state of packets
+ *		- total_packets: number of total packet
+ *		- register_array: array of register to hold data to send or receive from slaver
+ * @return: none
+ * @api
+ * @comment: all packets are started
+ */
+void Modbus::configure(const PacketConfig* config, PacketState* state, uint16_t total_packets, uint16_t* register_array)
+{
+	_packet_array = NULL;
+	_packet_config = config;
+	_packet_state = state;
+	_config_progmem = false;
+	_register_array = register_array;
+	_total_packets = total_packets;
+	_manual_request = false;
+	_gap_hold = false;
+
+	memset(state, 0, total_packets * sizeof(PacketState));
+	for (uint16_t i = 0; i < total_packets; i++)
+		state[i].connection = 1;
+}
+
+//-----------------------------------------------------------------------------------
+/* Intitialize packet table with config in flash
+ * @param: same as configure
+ * @return: none
+ * @api
+ * @comment: none
+ */
+void Modbus::configure_P(const PacketConfig* config, PacketState* state, uint16_t total_packets, uint16_t* register_array)
+{
+	configure(config, state, total_packets, register_array);
+	_config_progmem = true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Replace packet table while bus is running
+ * @param: same as configure
+ * @return: false if a table is already waiting
+ * @api
+ * @comment: see stageTable
+ */
+bool Modbus::reconfigure(Packet* packets, uint16_t total_packets, uint16_t* register_array)
+{
+	return stageTable(packets, NULL, NULL, false, total_packets, register_array);
+}
+
+bool Modbus::reconfigure(const PacketConfig* config, PacketState* state, uint16_t total_packets, uint16_t* register_array)
+{
+	return stageTable(NULL, config, state, false, total_packets, register_array);
+}
+
+bool Modbus::reconfigure_P(const PacketConfig* config, PacketState* state, uint16_t total_packets, uint16_t* register_array)
+{
+	return stageTable(NULL, config, state, true, total_packets, register_array);
+}
+
+//-----------------------------------------------------------------------------------
+/* Stage a table for reconfigure
+ * @param: Packet array, or config and state tables, and registers of master
+ * @return: false if a table is already waiting
+ * @private
+ * @comment: table is filled before its flag is set, so it may be staged from
+ *			another task than the one which calls update()
+ */
+bool Modbus::stageTable(Packet* packets, const PacketConfig* config, PacketState* state, bool progmem,
+						uint16_t total_packets, uint16_t* register_array)
+{
+	if (atomicLoad(&_staged))
+		return false;
+
+	_staged_table.packets = packets;
+	_staged_table.config = config;
+	_staged_table.state = state;
+	_staged_table.progmem = progmem;
+	_staged_table.total_packets = total_packets;
+	_staged_table.register_array = register_array;
+	atomicStore(&_staged, 1);
+	return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Take staged table
+ * @param: none
+ * @return: none
+ * @private
+ * @comment: packets are usually kept in order, so search of a current packet starts
+ *			after the last match. Scan goes on from the same packet if it is kept
+ */
+void Modbus::publishTable()
+{
+	PacketTable current = { _packet_array, _packet_config, _packet_state, _config_progmem,
+							_total_packets, _register_array };
+	PacketTable* table = &_staged_table;
+	uint16_t next = (_packet_index < table->total_packets) ? _packet_index : 0;
+	uint16_t hint = 0;
+
+	for (uint16_t j = 0; j < table->total_packets; j++)
+	{
+		PacketConfig config;
+		PacketState state;
+		readTable(table, j, &config, NULL);
+		memset(&state, 0, sizeof(state));
+		state.connection = 1;
+
+		for (uint16_t k = 0; k < current.total_packets; k++)
+		{
+			uint16_t i = (hint + k) % current.total_packets;
+			PacketConfig current_config;
+			PacketState current_state;
+			readTable(&current, i, &current_config, &current_state);
+
+			//data of function 6 and 22 is taken from registers, it is not config
+			if ( current_config.id != config.id
+				|| current_config.function != config.function
+				|| current_config.address != config.address
+				|| current_config.register_start_address != config.register_start_address
+				|| ( current_config.data != config.data
+					&& config.function != PRESET_SINGLE_REGISTER
+					&& config.function != MASK_WRITE_REGISTER ) )
+				continue;
+
+			state = current_state;
+			if (i == _packet_index)
+				next = j;
+			hint = i + 1;
+			break;
+		}
+		writeTable(table, j, &state);
+	}
+
+	_packet_array = table->packets;
+	_packet_config = table->config;
+	_packet_state = table->state;
+	_config_progmem = table->progmem;
+	_total_packets = table->total_packets;
+	_register_array = table->register_array;
+	_packet_index = next;
+
+	atomicStore(&_staged, 0);
+}
+
+//-----------------------------------------------------------------------------------
+/* Read config and state of a packet of a table
+ * @param: table, index of packet, config and state to fill. State may be NULL
+ * @return: none
+ * @private
+ * @comment: none
+ */
+void Modbus::readTable(const PacketTable* table, uint16_t index, PacketConfig* config, PacketState* state)
+{
+	if (table->packets)
+	{
+		const Packet* packet = &table->packets[index];
+		config->id = packet->id;
+		config->function = packet->function;
+		config->address = packet->address;
+		config->data = packet->data;
+		config->register_start_address = packet->register_start_address;
+		if (state)
+		{
+#if MODBUS_STATISTICS
+			state->requests = packet->requests;
+			state->successful_requests = packet->successful_requests;
+			state->failed_requests = packet->failed_requests;
+			state->exception_errors = packet->exception_errors;
+#endif
+			state->retries = packet->retries;
+			state->connection = packet->connection;
+		}
+		return;
+	}
+
+	if (table->progmem)
+		memcpy_P(config, &table->config[index], sizeof(PacketConfig));
+	else
+		*config = table->config[index];
+	if (state)
+		*state = table->state[index];
+}
+
+//-----------------------------------------------------------------------------------
+/* Write state of a packet of a table
+ * @param: table, index of packet and its state
+ * @return: none
+ * @private
+ * @comment: none
+ */
+void Modbus::writeTable(PacketTable* table, uint16_t index, const PacketState* state)
+{
+	if (!table->packets)
+	{
+		table->state[index] = *state;
+		return;
+	}
+
+	Packet* packet = &table->packets[index];
+#if MODBUS_STATISTICS
+	packet->requests = state->requests;
+	packet->successful_requests = state->successful_requests;
+	packet->failed_requests = state->failed_requests;
+	packet->exception_errors = state->exception_errors;
+#endif
+	packet->retries = state->retries;
+	packet->connection = state->connection;
+}
+
+//-----------------------------------------------------------------------------------
+/* Connection status of cyclic packet
+ * @param: index of packet
+ * @return: 1 if packet is requested
+ * @private
+ * @comment: only state of packet table is read, config stays in flash
+ */
+uint8_t Modbus::connected(uint16_t index)
+{
+	if (_packet_array)
+		return _packet_array[index].connection;
+	return _packet_state[index].connection;
+}
+
+//-----------------------------------------------------------------------------------
+/* Get cyclic packet
+ * @param: index of packet and cursor slot for packet table
+ * @return: packet
+ * @private
+ * @comment: packet of packet table is copied into _cursor[slot], its state is
+ *			saved back by storePackets when transaction is finished
+ */
+Packet* Modbus::loadPacket(uint16_t index, uint8_t slot)
+{
+	if (_packet_array)
+		return &_packet_array[index];
+
+	PacketConfig config;
+	if (_config_progmem)
+		memcpy_P(&config, &_packet_config[index], sizeof(PacketConfig));
+	else
+		config = _packet_config[index];
+
+	Packet* packet = &_cursor[slot];
+	packet->id = config.id;
+	packet->function = config.function;
+	packet->address = config.address;
+	packet->data = config.data;
+	packet->register_start_address = config.register_start_address;
+
+	PacketState* state = &_packet_state[index];
+#if MODBUS_STATISTICS
+	packet->requests = state->requests;
+	packet->successful_requests = state->successful_requests;
+	packet->failed_requests = state->failed_requests;
+	packet->exception_errors = state->exception_errors;
+#endif
+	packet->retries = state->retries;
+	packet->connection = state->connection;
+	return packet;
+}
+
+//-----------------------------------------------------------------------------------
+/* Save state of packet table packets in current transaction
+ * @param: none
+ * @return: none
+ * @private
+ * @comment: nothing to do for Packet array and one-shot packets
+ */
+void Modbus::storePackets()
+{
+	if (_packet != _cursor)
+		return;
+
+	for (uint8_t i = 0; i < _group_size; i++)
+	{
+		PacketState* state = &_packet_state[_cursor_index + i];
+#if MODBUS_STATISTICS
+		state->requests = _cursor[i].requests;
+		state->successful_requests = _cursor[i].successful_requests;
+		state->failed_requests = _cursor[i].failed_requests;
+		state->exception_errors = _cursor[i].exception_errors;
+#endif
+		state->retries = _cursor[i].retries;
+		state->connection = _cursor[i].connection;
+	}
 }
 
 //-----------------------------------------------------------------------------------
@@ -664,26 +2017,29 @@ uint16_t Modbus::calculateCRC(uint8_t frame_size)
  */
 void Modbus::sendPacket(uint8_t bufferSize)
 {
+#if MODBUS_CAPTURE
+	captureFrame(CAPTURE_TX, _clock->micros(), bufferSize);
+#endif
+	trace(TRACE_TX, (frame[1] << 8) | bufferSize);
+	_request_start = _clock->millis();
+
 	TxEnable();	//Enable transmittion
 		
 	for (uint8_t i = 0; i < bufferSize; i++)
 	{
-		// #if DEBUG_UART
-		// Serial.print(frame[i]);
-		// #endif
 		(*_modbusPort).write(frame[i]);
 	}
-	// #if DEBUG_UART
-	// Serial.println();
-	// #endif
 		
 	(*_modbusPort).flush();
 	
-	delayMicroseconds(_frame_delay);
+	_clock->delayMicroseconds(_frame_delay);
 	
 	TxDisable();	//Disable transmittion
 		
-	_delayStart = millis(); // start the timeout delay	
+	_delayStart = _clock->millis(); // start the timeout delay	
+	_bus_idle = _clock->micros();
+	_rx_pending = false;
+	_rx_started = false;
 }
 
 
@@ -700,6 +2056,21 @@ uint8_t Modbus::getPacket()
 	// 	return 0;
 	if ( ((*_modbusPort).available() > 0)  )
 	{
+		/*
+		A response is read at once when it is complete, so update() does not wait
+		for it byte by byte. A shorter frame, e.g. an exception response, is read
+		when the expected response would have been received.
+		*/
+		if (!_rx_pending)
+		{
+			_rx_pending = true;
+			_rx_first = _clock->micros();
+		}
+		if ( ((*_modbusPort).available() < _response_size)
+			&& (_clock->micros() - _rx_first) < (unsigned long)_response_size * _byte_time )
+			return 0;
+		_rx_pending = false;
+
 		uint8_t overflowFlag = 0;
 		uint8_t buffer = 0;
 		while((*_modbusPort).available())
@@ -712,28 +2083,43 @@ uint8_t Modbus::getPacket()
 	      	still responding.
 	      	*/
 			if (overflowFlag)
+				(*_modbusPort).read();
+			else if (buffer == BUFFER_SIZE)
 			{
-				println(F("Overflow"));
+				overflowFlag = 1;
 				(*_modbusPort).read();
 			}
 			else
 			{
-				if (buffer == BUFFER_SIZE)
-					overflowFlag = 1;
 				frame[buffer] = (*_modbusPort).read();
 				buffer++;
 			}
 			
 			/*
 			This is not 100% correct but it will suffice.
-			worst case scenario is if more than one character time expires
-			while reading from the buffer then the buffer is most likely empty
+			Bytes already in the serial buffer are read at once, the master only
+			waits a character time when the buffer is empty. If more than one
+			character time expires without a new byte the frame is complete.
 			If there are more bytes after such a delay it is not supposed to
 			be received and thus will force a frame_error.
 			*/
-			delayMicroseconds(T1_5); //character time wait
+			if (!(*_modbusPort).available())
+			{
+				_clock->delayMicroseconds(T1_5); //character time wait
+				if ((*_modbusPort).available())
+				{
+					trace(TRACE_GAP, buffer);
+				}
+			}
 		}
 
+		_bus_idle = _clock->micros() - T1_5;	//last byte of response came before the character time wait
+
+#if MODBUS_CAPTURE
+		captureFrame(CAPTURE_RX, _rx_first, buffer);
+#endif
+		trace(TRACE_RX, buffer);
+
 		/*
 		The minimum buffer size from a slave can be an exception response of
     	5 bytes. If the buffer was partially filled set a frame_error.
@@ -742,26 +2128,28 @@ uint8_t Modbus::getPacket()
 		*/
 		if ( buffer < 5 || overflowFlag )
 		{
-			//println(F("Buffer errors"));
+			trace(TRACE_FRAME, buffer);
 			buffer = 0;
 		}
 		else if ( frame[0] != _packet->id )  //return if ID returned is not matched
 		{
-			//println(F("ID not matched"));
+			trace(TRACE_SLAVE, frame[0]);
 			buffer = 0;
 		}
 #if DEBUG_HMI
-		_response_time = millis() - _delayStart;	//return the response time
+		_response_time = _clock->millis() - _delayStart;	//return the response time
 #endif
 		return buffer;
 	} //serial available
 	else
 	if (!_manual_request)
 	{
-		if (((millis() - _delayStart) > _timeout ) && !_transmission_ready_flag )
+		//Next transmission is allowed by status() after the gap, like after a response
+		if (((_clock->millis() - _delayStart) > _timeout ) && !_transmission_ready_flag && !_response_flag )
 		{
-			println("timeout");
-			_transmission_ready_flag = true;	//allow to start new transmission
+			trace(TRACE_TIMEOUT, _clock->millis() - _delayStart);
+			_bus_idle = _clock->micros();
+			learnTurnaround(_packet->id, true);
 			packetError();
 			
 		}
@@ -772,6 +2160,314 @@ uint8_t Modbus::getPacket()
 
 
 
+//-----------------------------------------------------------------------------------
+/* Replay capture trace
+ * @param: trace in capture format, its size and registers to decode into
+ * @return: number of response frames processed
+ * @api
+ * @comment: request frame of each TX record is turned into a temporary packet,
+ *			so the following RX record is checked exactly like a live response
+ */
+uint16_t Modbus::replay(const uint8_t* trace, uint16_t size, uint16_t* register_array)
+{
+	Packet replay_packet;
+	memset(&replay_packet, 0, sizeof(replay_packet));
+
+	uint16_t processed = 0;
+	uint16_t index = 0;
+	while (index + CAPTURE_HEADER <= size)
+	{
+		uint8_t direction = trace[index + 4];
+		uint8_t length = trace[index + 5];
+		const uint8_t* data = &trace[index + CAPTURE_HEADER];
+
+		index += CAPTURE_HEADER + length;
+		if (index > size)	//truncated record
+			break;
+
+		if (direction == CAPTURE_TX)
+		{
+			if (length < 6)
+				continue;
+			replay_packet.id = data[0];
+			replay_packet.function = data[1];
+			replay_packet.address = (data[2] << 8) | data[3];
+			replay_packet.data = (data[4] << 8) | data[5];
+			replay_packet.connection = 1;
+		}
+		else if (length >= 5 && length <= BUFFER_SIZE && data[0] == replay_packet.id)
+		{
+			decode(&replay_packet, data, length, register_array);
+			processed++;
+		}
+	}
+
+	return processed;
+}
+
+//-----------------------------------------------------------------------------------
+/* Decode a response frame
+ * @param: requested packet, response frame, its size and registers to decode into
+ * @return: 1 if response is accepted
+ * @api
+ * @comment: frame goes through the same checks as a live response. It is safe to
+ *			call with any bytes, so it is the entry point for fuzzing the decoder
+ */
+uint8_t Modbus::decode(Packet* packet, const uint8_t* response, uint8_t size, uint16_t* register_array)
+{
+	//Same filter as getPacket, wrong ID or broken frame is ignored
+	if ( (size < 5) || (size > BUFFER_SIZE) || (response[0] != packet->id) )
+		return 0;
+
+	//Keep state of live transmission
+	Packet* live_packet = _packet;
+	uint16_t* registers = _register_array;
+	uint16_t total_fail = _total_fail;
+	long delay_start = _delayStart;
+#if MODBUS_GROUP
+	uint8_t group_size = _group_size;
+#endif
+	uint8_t request_function = _request_function;
+	bool response_flag = _response_flag;
+	uint8_t gap_mode = _gap_mode;
+	ModbusCallback callback = _callback;
+	PointCallback point_callback = _point_callback;
+	PointMap* point_maps = _point_maps;
+	uint16_t total_watched = _total_watched;
+	ModbusRequest* requests = _requests;
+	uint8_t turnaround_size = _turnaround_size;
+
+	_packet = packet;
+	_gap_mode = GAP_FIXED;	//replayed frames do not teach turnaround guards
+	_turnaround_size = 0;	//nor free them when a replayed packet is given up
+	_callback = NULL;
+	_point_callback = NULL;
+	_point_maps = NULL;	//replayed registers do not reach point targets
+	_total_watched = 0;	//replayed registers are not marked changed
+	_requests = NULL;
+#if MODBUS_GROUP
+	_group_size = 1;
+#endif
+	_request_function = packet->function;
+	_register_array = register_array;
+#if MODBUS_TRACE
+	_trace_pause = true;	//events of replayed frames are not live events
+#endif
+
+	memcpy(frame, response, size);
+	processPacket(size);
+	uint8_t result = _response_ok;
+
+	_packet = live_packet;
+	_register_array = registers;
+	_total_fail = total_fail;
+	_delayStart = delay_start;
+#if MODBUS_GROUP
+	_group_size = group_size;
+#endif
+	_request_function = request_function;
+	_response_flag = response_flag;
+	_gap_mode = gap_mode;
+	_callback = callback;
+	_point_callback = point_callback;
+	_point_maps = point_maps;
+	_total_watched = total_watched;
+	_requests = requests;
+	_turnaround_size = turnaround_size;
+#if MODBUS_TRACE
+	_trace_pause = false;
+#endif
+
+	return result;
+}
+
+#if MODBUS_CAPTURE
+//-----------------------------------------------------------------------------------
+/* Record a frame into capture buffer
+ * @param: direction, time when frame starts and frame's size. Frame is taken from frame[]
+ * @return: none
+ * @private
+ * @comment: oldest records are dropped to make room
+ */
+void Modbus::captureFrame(uint8_t direction, unsigned long timestamp, uint8_t length)
+{
+	if (!_capture_enable)
+		return;
+
+	if (length > BUFFER_SIZE)
+		length = BUFFER_SIZE;
+
+	uint16_t record_size = CAPTURE_HEADER + length;
+	if (record_size > CAPTURE_SIZE)
+		return;
+
+	//Drop oldest records until new record fits
+	while (CAPTURE_SIZE - _capture_used < record_size)
+	{
+		uint16_t oldest = CAPTURE_HEADER + _capture[(_capture_tail + 5) % CAPTURE_SIZE];
+		_capture_tail = (_capture_tail + oldest) % CAPTURE_SIZE;
+		_capture_used -= oldest;
+	}
+
+	uint8_t header[CAPTURE_HEADER];
+	header[0] = timestamp & 0xFF;
+	header[1] = (timestamp >> 8) & 0xFF;
+	header[2] = (timestamp >> 16) & 0xFF;
+	header[3] = (timestamp >> 24) & 0xFF;
+	header[4] = direction;
+	header[5] = length;
+
+	for (uint8_t i = 0; i < CAPTURE_HEADER; i++)
+	{
+		_capture[_capture_head] = header[i];
+		if (++_capture_head == CAPTURE_SIZE)
+			_capture_head = 0;
+	}
+
+	//Copy frame in at most two pieces
+	uint16_t first = CAPTURE_SIZE - _capture_head;
+	if (first > length)
+		first = length;
+	memcpy(&_capture[_capture_head], frame, first);
+	memcpy(_capture, &frame[first], length - first);
+	_capture_head = (_capture_head + length) % CAPTURE_SIZE;
+
+	_capture_used += record_size;
+}
+
+//-----------------------------------------------------------------------------------
+/* Copy captured records into a linear buffer
+ * @param: buffer and its size
+ * @return: number of bytes copied
+ * @api
+ * @comment: oldest record first
+ */
+uint16_t Modbus::capture_read(uint8_t* buffer, uint16_t size)
+{
+	uint16_t copied = 0;
+	uint16_t index = _capture_tail;
+
+	while (copied < _capture_used)
+	{
+		uint16_t record_size = CAPTURE_HEADER + _capture[(index + 5) % CAPTURE_SIZE];
+		if (copied + record_size > size)
+			break;
+
+		for (uint16_t i = 0; i < record_size; i++)
+		{
+			buffer[copied++] = _capture[index];
+			if (++index == CAPTURE_SIZE)
+				index = 0;
+		}
+	}
+	return copied;
+}
+
+//-----------------------------------------------------------------------------------
+/* Write captured records to a stream and clear capture buffer
+ * @param: output stream
+ * @return: number of bytes written
+ * @api
+ * @comment: oldest record first
+ */
+uint16_t Modbus::capture_dump(Print* out)
+{
+	uint16_t written = 0;
+	uint16_t index = _capture_tail;
+
+	while (written < _capture_used)
+	{
+		(*out).write(_capture[index]);
+		written++;
+		if (++index == CAPTURE_SIZE)
+			index = 0;
+	}
+
+	capture_clear();
+	return written;
+}
+#endif
+
+#if MODBUS_TRACE
+//-----------------------------------------------------------------------------------
+/* Record a protocol event into trace ring
+ * @param: event and its value, see TRACE_TX and the following events
+ * @return: none
+ * @private
+ * @comment: a few stores and micros(). Ring has one writer and one reader, so it may
+ *			be read by another task. New events are dropped while ring is full,
+ *			events of decode() are not recorded
+ */
+void Modbus::traceEvent(uint8_t event, uint16_t value)
+{
+	if (_trace_pause)
+		return;
+
+	uint8_t head = _trace_head;
+	if ( (uint8_t)(head - atomicLoad(&_trace_tail)) == TRACE_RECORDS )
+	{
+		_trace_lost++;
+		return;
+	}
+
+	TraceRecord* record = &_trace[head & (TRACE_RECORDS - 1)];
+	record->time = _clock->micros();
+	record->event = event;
+	record->id = _packet ? _packet->id : 0;
+	record->value = value;
+	atomicStore(&_trace_head, head + 1);
+}
+
+//-----------------------------------------------------------------------------------
+/* Move trace records into a buffer
+ * @param: buffer and its size
+ * @return: number of bytes copied, TRACE_RECORD per record
+ * @api
+ * @comment: oldest record first, records are removed from ring
+ */
+uint16_t Modbus::trace_read(uint8_t* buffer, uint16_t size)
+{
+	uint16_t copied = 0;
+	uint8_t tail = _trace_tail;
+	uint8_t head = atomicLoad(&_trace_head);
+
+	while (tail != head && copied + TRACE_RECORD <= size)
+	{
+		const TraceRecord* record = &_trace[tail & (TRACE_RECORDS - 1)];
+		buffer[copied++] = record->time & 0xFF;
+		buffer[copied++] = (record->time >> 8) & 0xFF;
+		buffer[copied++] = (record->time >> 16) & 0xFF;
+		buffer[copied++] = (record->time >> 24) & 0xFF;
+		buffer[copied++] = record->event;
+		buffer[copied++] = record->id;
+		buffer[copied++] = record->value & 0xFF;
+		buffer[copied++] = record->value >> 8;
+		tail++;
+	}
+
+	atomicStore(&_trace_tail, tail);
+	return copied;
+}
+
+//-----------------------------------------------------------------------------------
+/* Write trace records to a stream
+ * @param: output stream
+ * @return: number of bytes written
+ * @api
+ * @comment: oldest record first, records are removed from ring
+ */
+uint16_t Modbus::trace_dump(Print* out)
+{
+	uint8_t buffer[TRACE_RECORD * 4];
+	uint16_t written = 0;
+	uint16_t size;
+
+	while ( (size = trace_read(buffer, sizeof(buffer))) > 0 )
+		written += (*out).write(buffer, size);
+	return written;
+}
+#endif
+
 //-----------------------------------------------------------------------------------
 /* Modbus enable transmission
  * @param: none
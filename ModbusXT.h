@@ -10,9 +10,94 @@ if you have any question, please feel free to email me at mr.caddish@gmail.com
 #define MODBUSXT_H_
 
 #include <Arduino.h>
+#include "ModbusXT_Point.h"
 
 #define BUFFER_SIZE 64
 
+#define REQUEST_PENDING 0   //Request is waiting or in progress
+#define REQUEST_DONE 1      //Request is finished successfully
+#define REQUEST_FAILED 2    //Request reached max retry
+
+#define MAX_RETRY 127       //Maximum retry of a packet table, it fits retries of PacketState
+
+#ifndef MODBUS_STATISTICS
+#define MODBUS_STATISTICS 1 //0: packets keep no request counters, saves 8 bytes SRAM per packet
+#endif
+#ifndef MODBUS_GROUP
+#define MODBUS_GROUP 0      //1: fuse() and coalesce() serve several packets with one transaction
+#endif
+#if MODBUS_GROUP
+#ifndef MAX_GROUP
+#if defined(__AVR__)
+#define MAX_GROUP 4         //Maximum packets served by one transaction, 2 to 8
+#else
+#define MAX_GROUP 8
+#endif
+#endif
+#else
+#undef MAX_GROUP
+#define MAX_GROUP 1
+#endif
+#define MAX_BLOCK_READ ((BUFFER_SIZE - 5) / 2)     //Registers in one chunk of a block read
+#define MAX_BLOCK_WRITE ((BUFFER_SIZE - 9) / 2)    //Registers in one chunk of a block write
+
+//Word of changed register bitmap, see Modbus::watch. 32 bit targets scan 32 registers at once
+#if defined(__AVR__)
+typedef uint8_t ChangeWord;
+#define CHANGE_BITS 8
+#else
+typedef uint32_t ChangeWord;
+#define CHANGE_BITS 32
+#endif
+#define CHANGE_WORDS(registers) (((registers) + CHANGE_BITS - 1) / CHANGE_BITS)    //size of bitmap
+
+#define GAP_FIXED 0         //wait polling time after every response
+#define GAP_ADAPTIVE 1      //wait 3.5 character times plus learned turnaround of slave
+#define MAX_GUARD 20000     //Maximum turnaround guard in microsecond
+
+#ifndef MODBUS_CAPTURE
+#define MODBUS_CAPTURE 0    //1: record every TX/RX frame into capture buffer
+#endif
+#define CAPTURE_SIZE 512    //Size of capture buffer in bytes
+
+#define CAPTURE_TX 0    //Capture record of request frame
+#define CAPTURE_RX 1    //Capture record of response frame
+/*
+Capture record format, records are stored oldest first:
+    - timestamp: 4 bytes, micros() when frame starts, low byte first
+    - direction: 1 byte, CAPTURE_TX or CAPTURE_RX
+    - length: 1 byte, number of frame bytes
+    - frame: length bytes, as sent or received on the bus
+*/
+#define CAPTURE_HEADER 6
+
+#ifndef MODBUS_TRACE
+#define MODBUS_TRACE 0      //1: record protocol events into trace ring
+#endif
+#define TRACE_RECORDS 32    //Records in trace ring, power of 2 up to 128
+
+//Trace events, value of record is given for each event
+#define TRACE_TX 1          //request sent: function << 8 | frame size
+#define TRACE_RX 2          //response read: frame size
+#define TRACE_GAP 3         //silence of 1.5 character times inside a response: bytes before it
+#define TRACE_FRAME 4       //frame too short or too long: frame size
+#define TRACE_SLAVE 5       //response of another slave: its ID
+#define TRACE_CRC 6         //CRC error: received CRC
+#define TRACE_FUNCTION 7    //response to another function: its function code
+#define TRACE_EXCEPTION 8   //exception response: exception code
+#define TRACE_LENGTH 9      //size of response does not match its function: frame size
+#define TRACE_TIMEOUT 10    //no response: time since request in milisecond
+#define TRACE_RETRY 11      //packet failed and is retried: retries so far
+#define TRACE_GIVE_UP 12    //packet reached max retry: retries
+/*
+Trace record format of trace_read, see extras/trace_decode.py:
+    - time: 4 bytes, micros() of event, low byte first
+    - event: 1 byte
+    - id: 1 byte, slave ID of current packet
+    - value: 2 bytes, low byte first
+*/
+#define TRACE_RECORD 8
+
 #define COIL_OFF 0x0000 // Function 5 OFF request is 0x0000
 #define COIL_ON 0xFF00 // Function 5 ON request is 0xFF00
 #define READ_COIL_STATUS 1 // Reads the ON/OFF status of discrete outputs (0X references, coils) in the slave.
@@ -23,6 +108,8 @@ if you have any question, please feel free to email me at mr.caddish@gmail.com
 #define PRESET_SINGLE_REGISTER 6 // Presets a value into a single holding register (4X reference).
 #define FORCE_MULTIPLE_COILS 15 // Forces each coil (0X reference) in a sequence of coils to either ON or OFF.
 #define PRESET_MULTIPLE_REGISTERS 16 // Presets values into a sequence of holding registers (4X references).
+#define MASK_WRITE_REGISTER 22 // Modifies a holding register (4X reference) with an AND mask and an OR mask.
+#define READ_WRITE_MULTIPLE_REGISTERS 23 // Writes a sequence of holding registers then reads a sequence of holding registers in one transaction.
 
 typedef struct {
     //Packet unique info
@@ -36,23 +123,155 @@ typedef struct {
     For function 6 data is exactly that, one register's data
     For functions 3, 4 & 16 data is the number of registers to read
     For function 15 data is the number of coils to write
+    For function 22 data is the AND mask, which is taken from register_start_address.
+    The OR mask is taken from the next register
+    For function 23 data is the number of registers to read, registers to write
+    are taken from the next packet which need to be function 16 to the same id.
+    With MODBUS_GROUP 0 it is sent as function 3
     */
     
     uint16_t    register_start_address;    //start register of Master to write or read from slave.
 
     //Modbus information
+#if MODBUS_STATISTICS
     uint16_t    requests;
     uint16_t    successful_requests;
     uint16_t    failed_requests;
     uint16_t    exception_errors;
+#endif
     uint16_t    retries;
 
     //Packet connection status
     uint8_t connection;
 } Packet;
 
+/*
+Packet table: immutable config and runtime state of packets are kept in two arrays.
+Config can be stored in flash with PROGMEM, then only PacketState stays in SRAM.
+*/
+typedef struct {
+    uint8_t     id;
+    uint8_t     function;
+    uint16_t    address;
+    uint16_t    data;   //same meaning as data of Packet
+    uint16_t    register_start_address;
+} PacketConfig;
+
+typedef struct {
+#if MODBUS_STATISTICS
+    uint16_t    requests;
+    uint16_t    successful_requests;
+    uint16_t    failed_requests;
+    uint16_t    exception_errors;
+#endif
+    uint8_t     retries : 7;    //retry of packet table is limited to MAX_RETRY
+    uint8_t     connection : 1;
+} PacketState;
+
+/*
+Packet table staged by Modbus::reconfigure, either a Packet array or config and state tables.
+*/
+typedef struct {
+    Packet*             packets;        //Packet array, NULL for config and state tables
+    const PacketConfig* config;
+    PacketState*        state;
+    bool                progmem;        //config is in flash
+    uint16_t            total_packets;
+    uint16_t*           register_array;
+} PacketTable;
+
+typedef struct {
+    unsigned long   time;
+    uint8_t         event;
+    uint8_t         id;
+    uint16_t        value;
+} TraceRecord;
+
 typedef Packet* packetPointer;
 
+//Called when transaction of a packet is finished, success is false when packet is given up
+typedef void (*ModbusCallback)(Packet* packet, bool success);
+
+//Called when a task blocked on idle() time should run update() early, see ModbusXT_OS.h
+typedef void (*ModbusWake)(void* arg);
+
+typedef struct {
+    uint8_t     id;     //slave ID, 0 is a free entry
+    uint16_t    guard;  //silence needed before a request to slave, on top of 3.5 character times. In microsecond
+} Turnaround;
+
+typedef struct {
+    Packet*         packet;
+    uint8_t         priority;       //higher priority is sent first
+    unsigned long   queued_time;    //time when packet was queued, in milisecond
+} QueuedPacket;
+
+/*
+Request submitted by any task or interrupt, see Modbus::submit.
+It belongs to the master until done is called, or without done until status is not REQUEST_PENDING.
+*/
+typedef struct ModbusRequest {
+    Packet*         packet;     //packet to send once
+    uint8_t         priority;   //priority in one-shot queue
+    volatile uint8_t status;    //REQUEST_PENDING, REQUEST_DONE or REQUEST_FAILED
+    void            (*done)(struct ModbusRequest* request);    //called by bus task when request is finished, may be NULL
+    void*           arg;        //user data, e.g. semaphore of waiting task
+
+    struct ModbusRequest* next; //requests in progress, used by master
+    uint16_t        transaction;    //total requests when request was taken, used by master
+} ModbusRequest;
+
+/*
+Block transfer of more registers than one frame holds, see Modbus::transfer.
+It belongs to the master until status is not REQUEST_PENDING.
+*/
+typedef struct ModbusBlock {
+    uint8_t     id;         //slave ID
+    uint8_t     function;   //READ_HOLDING_REGISTERS, READ_INPUT_REGISTERS or PRESET_MULTIPLE_REGISTERS
+    uint16_t    address;    //first register of slave
+    uint16_t    count;      //number of registers
+    void        (*data)(struct ModbusBlock* block, uint16_t address, uint16_t* registers, uint8_t count);  //read: takes a decoded chunk, write: fills a chunk
+    void*       arg;        //user data, e.g. file to write into
+    uint8_t     share;      //percent of bus time taken from other packets, 1 to 100
+
+    //Progress, set by master
+    volatile uint8_t status;    //REQUEST_PENDING, REQUEST_DONE or REQUEST_FAILED
+    uint16_t    done;           //registers transferred
+    unsigned long start;        //millis() when transfer started
+    unsigned long finish;       //millis() when transfer finished
+
+    //Current chunk, used by master
+    Packet      packet;
+    uint16_t    registers[MAX_BLOCK_READ];
+} ModbusBlock;
+
+typedef struct {
+    ModbusRequest*      request;
+    volatile uint8_t    sequence;   //lap of slot: free for positions of this lap, or filled when 1 more
+} SubmitSlot;
+
+/*
+Time source of the master. Default is the Arduino clock, a simulation passes its own,
+e.g. ModbusVirtualClock of ModbusXT_Sim.h, so timeouts and gaps run in virtual time.
+*/
+class ModbusClock {
+    public:
+        virtual unsigned long millis()
+        {
+            return ::millis();
+        }
+
+        virtual unsigned long micros()
+        {
+            return ::micros();
+        }
+
+        virtual void delayMicroseconds(unsigned int time)
+        {
+            ::delayMicroseconds(time);
+        }
+};
+
 class  Modbus {
     public:
         
@@ -68,6 +287,17 @@ class  Modbus {
 #else
         void begin(HardwareSerial* modbusPort, long baud, uint8_t byteFormat, long timeout, long polling, uint8_t retry, uint8_t _TxEnablePin);
 #endif
+
+        //-----------------------------------------------------------------------------------
+        /* Config Modbus parameter on any stream, e.g. a simulated bus
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: stream need to be started before, baud is only used for frame timing.
+         *           Retry of a packet table configured by PacketConfig is limited to
+         *           MAX_RETRY, Packet arrays take any retry
+         */
+        void begin(Stream* modbusPort, long baud, long timeout, long polling, uint8_t retry, uint8_t TxEnablePin);
         
         //-----------------------------------------------------------------------------------
         /* Configure Modbus packets
@@ -87,6 +317,55 @@ class  Modbus {
          */
         void configure_manual(Packet *packets, uint16_t total_packet, uint16_t* register_array); 
 
+        //-----------------------------------------------------------------------------------
+        /* Configure Modbus packet table, config in SRAM
+         * @param: 
+         *      - config: config of packets
+         *      - state: runtime state of packets, one per config. It is initialized here
+         *      - total_packet: number of packets
+         *      - register_array: registers of master
+         * @return: none
+         * @api
+         * @comment: packets are started automatically, construct is not needed
+         */
+        void configure(const PacketConfig *config, PacketState *state, uint16_t total_packet, uint16_t* register_array); 
+
+        //-----------------------------------------------------------------------------------
+        /* Configure Modbus packet table, config in flash
+         * @param: same as configure, config need to be declared with PROGMEM
+         * @return: none
+         * @api
+         * @comment: none
+         */
+        void configure_P(const PacketConfig *config, PacketState *state, uint16_t total_packet, uint16_t* register_array); 
+
+        //-----------------------------------------------------------------------------------
+        /* Replace packet table while bus is running
+         * @param: same as configure. New table need to be in its own memory, register
+         *         array may be the same
+         * @return: false if a table is already waiting
+         * @api
+         * @comment: table is taken by update() or request() between two transactions.
+         *           A packet with the same slave, function, address, size and registers
+         *           as a current one keeps its statistics, retries and connection. Other
+         *           packets start fresh and are requested within one cycle.
+         *           Current table may be reused when reconfigured() returns true
+         */
+        bool reconfigure(Packet *packets, uint16_t total_packet, uint16_t* register_array);
+        bool reconfigure(const PacketConfig *config, PacketState *state, uint16_t total_packet, uint16_t* register_array);
+        bool reconfigure_P(const PacketConfig *config, PacketState *state, uint16_t total_packet, uint16_t* register_array);
+
+        //-----------------------------------------------------------------------------------
+        /* Check if table of reconfigure is taken
+         * @param: none
+         * @return: true if no table is waiting
+         * @api
+         */
+        bool reconfigured()
+        {
+            return !_staged;
+        }
+
         //-----------------------------------------------------------------------------------
         /* Construct individual packet with automatic start requesting packet
          * @param: none
@@ -101,6 +380,132 @@ class  Modbus {
                                         uint16_t data,
                                         uint16_t register_start_address); 
 
+#if MODBUS_GROUP
+        //-----------------------------------------------------------------------------------
+        /* Fuse read/write packet pairs into function 23
+         * @param: true to enable
+         * @return: none
+         * @api
+         * @comment: a READ_HOLDING_REGISTERS packet followed by a PRESET_MULTIPLE_REGISTERS
+         *           packet to the same id is sent as one READ_WRITE_MULTIPLE_REGISTERS
+         *           transaction. Both packets keep their own statistics
+         */
+        void fuse(bool enable)
+        {
+            _fuse = enable;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Coalesce single writes into function 16 or 15
+         * @param: true to enable
+         * @return: none
+         * @api
+         * @comment: PRESET_SINGLE_REGISTER packets which follow each other in the packet table,
+         *           go to the same id and write following addresses are sent as one
+         *           PRESET_MULTIPLE_REGISTERS transaction, FORCE_SINGLE_COIL packets as one
+         *           FORCE_MULTIPLE_COILS transaction. Up to MAX_GROUP packets are merged,
+         *           each packet keeps its own statistics. Slave need to support function 16 or 15
+         */
+        void coalesce(bool enable)
+        {
+            _coalesce = enable;
+        }
+#endif
+
+        //-----------------------------------------------------------------------------------
+        /* Set function called when transaction of a packet is finished
+         * @param: function, NULL to remove it
+         * @return: none
+         * @api
+         * @comment: it is called after each successful response, and when a packet reaches
+         *           max retry. Packets of packet table are passed as a copy, only their
+         *           config and statistics are valid. It may call send()
+         */
+        void callback(ModbusCallback function)
+        {
+            _callback = function;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Select gap between two transactions in auto update mode
+         * @param: 
+         *      - GAP_FIXED: wait polling time after every response or timeout (default)
+         *      - GAP_ADAPTIVE: wait 3.5 character times of silence plus the turnaround guard
+         *        learned for the next slave. Polling is then the minimum time between two
+         *        requests, it caps bus load. Use 0 polling for full bus speed
+         *      - table: learned turnaround guards, one entry for each slow slave. Without it
+         *        GAP_ADAPTIVE waits 3.5 character times only
+         *      - size: number of entries
+         * @return: none
+         * @api
+         * @comment: a guard grows when a slave does not answer or answers a broken frame,
+         *           and shrinks slowly while it answers. When table is full the smallest
+         *           guard is taken over
+         */
+        void gap(uint8_t mode, Turnaround* table = NULL, uint8_t size = 0)
+        {
+            _gap_mode = mode;
+            _turnaround = table;
+            _turnaround_size = table ? size : 0;
+            clearTurnaround();
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Return learned turnaround guard of a slave
+         * @param: slave ID
+         * @return: time in microsecond, 0 if slave needs only 3.5 character times
+         * @api
+         * @comment: 
+         */
+        uint16_t turnaround(uint8_t id);
+
+        //-----------------------------------------------------------------------------------
+        /* Map typed points onto master register array
+         * @param: 
+         *      - map: map which keeps the points, it belongs to the master from now on
+         *      - points: points of the map, see ModbusXT_Point.h
+         *      - total_points: number of points
+         *      - register_start: first register of map in master register array
+         * @return: none
+         * @api
+         * @comment: points are decoded from current registers, then again after each
+         *           successful read which changes one of their registers. Mapping a map
+         *           again only changes its points
+         */
+        void map(PointMap* map, const Point* points, uint8_t total_points, uint16_t register_start);
+
+        //-----------------------------------------------------------------------------------
+        /* Set function called when target of a point changed
+         * @param: function, NULL to remove it
+         * @return: none
+         * @api
+         * @comment: a change inside the deadband of point is not reported
+         */
+        void notify(PointCallback function)
+        {
+            _point_callback = function;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Mark registers changed by reads in a bitmap
+         * @param:
+         *      - changed: bitmap of CHANGE_WORDS(total_registers) words, one bit per register
+         *      - total_registers: registers of master register array to watch
+         * @return: none
+         * @api
+         * @comment: bitmap is cleared. NULL stops marking
+         */
+        void watch(ChangeWord* changed, uint16_t total_registers);
+
+        //-----------------------------------------------------------------------------------
+        /* Take next changed register
+         * @param: index of register to start from, set to the changed register
+         * @return: false if no register from index on has changed
+         * @api
+         * @comment: bit of register is cleared. Unchanged words of bitmap are skipped
+         */
+        bool next_change(uint16_t* index);
+
         //-----------------------------------------------------------------------------------
         /* Modbus packet data returned
          * @param: none
@@ -185,13 +590,401 @@ class  Modbus {
         {
             return _total_fail;
         }
+
+        //-----------------------------------------------------------------------------------
+        /* Set storage of one-shot queue
+         * @param: array of queue slots and number of slots, NULL for no queue
+         * @return: none
+         * @api
+         * @comment: call it before the first send(), without storage send(), bit_write()
+         *           and submit() are refused. Packets waiting in a previous storage are dropped
+         */
+        void queue(QueuedPacket* slots, uint8_t size)
+        {
+            _queue = slots;
+            _queue_size = slots ? size : 0;
+            _queue_count = 0;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Queue one-shot packet. It is sent at the next idle slot, ahead of cyclic packets
+         * @param: 
+         *      - packet: packet to send once, it does not need to be in packet array
+         *      - priority: higher priority is sent first, same priority is sent in queued order
+         * @return: false if queue is full or has no storage
+         * @api
+         * @comment: packet is retried like a cyclic packet until success or max retry.
+         *           Queuing a packet which is already waiting only raises its priority.
+         *           Slots are given by queue(): until it is called send() returns false
+         */
+        bool send(Packet *packet, uint8_t priority = 0);
+
+        //-----------------------------------------------------------------------------------
+        /* Set storage of submission queue
+         * @param: array of submit slots and number of slots, a power of 2 from 2 up to 128
+         * @return: false if size is not a power of 2 of at least 2
+         * @api
+         * @comment: call it before any task submits. Submitted requests also need the
+         *           one-shot queue, see queue()
+         */
+        bool submit_queue(SubmitSlot* slots, uint8_t size);
+
+        //-----------------------------------------------------------------------------------
+        /* Submit a request from a task, or from an interrupt with submitFromISR
+         * @param: request with packet, priority and optional done function
+         * @return: false if submission queue is full or has no storage, status is then
+         *          REQUEST_FAILED
+         * @api
+         * @comment: submission queue is lock-free with many producers. The task which calls
+         *           update() or request() is the only consumer, it moves requests into the
+         *           one-shot queue and finishes them. Status is set before done is called.
+         *           A request is only finished by a transaction sent after it was taken.
+         *           They differ only in the wake function they call, see wake()
+         */
+        bool submit(ModbusRequest *request);
+        bool submitFromISR(ModbusRequest *request);
+
+        //-----------------------------------------------------------------------------------
+        /* Start a block transfer
+         * @param: block with slave, range, data function and share of bus time
+         * @return: false if a block transfer is already running, function is not
+         *          READ_HOLDING_REGISTERS, READ_INPUT_REGISTERS or PRESET_MULTIPLE_REGISTERS,
+         *          or range is empty or goes past register 0xFFFF
+         * @api
+         * @comment: range is split into frames of MAX_BLOCK_READ or MAX_BLOCK_WRITE
+         *           registers. Each chunk is passed to or taken from data function, only
+         *           one chunk is kept in RAM, inside the block. Chunks take turns with cyclic and one-shot
+         *           packets by bus time, a failed chunk is retried like a cyclic packet.
+         *           Call it from the task which calls update(), like send()
+         */
+        bool transfer(ModbusBlock *block);
+
+        //-----------------------------------------------------------------------------------
+        /* Throughput of a block transfer
+         * @param: block
+         * @return: registers per second, up to now while block is running
+         * @api
+         */
+        unsigned long transfer_rate(const ModbusBlock *block);
+
+        //-----------------------------------------------------------------------------------
+        /* Set functions which wake the task calling update()
+         * @param:
+         *      - task: called by submit(), it runs in the submitting task
+         *      - isr: called by submitFromISR() and received(), it runs in an interrupt
+         *      - arg: argument of both functions
+         * @return: none
+         * @api
+         * @comment: NULL removes a function. ModbusEvent::wake and ModbusEvent::wakeFromISR
+         *           of ModbusXT_OS.h are such a pair. When received() is called from a task,
+         *           e.g. a driver callback, pass the task function for both
+         */
+        void wake(ModbusWake task, ModbusWake isr, void* arg)
+        {
+            _wake_task = task;
+            _wake_isr = isr;
+            _wake_arg = arg;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Set time source of master
+         * @param: clock, NULL for the Arduino clock
+         * @return: none
+         * @api
+         * @comment: set it before begin(), all timeouts, gaps and statistics use it
+         */
+        void clock(ModbusClock* clock)
+        {
+            _clock = clock ? clock : &_system_clock;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Tell master that bytes were received on its port
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: call it from serial receive interrupt or driver callback. Task is woken
+         *           on first byte of a response and when expected response size is received,
+         *           not on every byte
+         */
+        void received();
+
+        //-----------------------------------------------------------------------------------
+        /* Time update() has nothing to do
+         * @param: none
+         * @return: time in microsecond, 0 if update() should be called now
+         * @api
+         * @comment: covers polling, gap, response timeout and end of a response frame.
+         *           Without received() a response is checked once per expected frame time.
+         *           Task can sleep this long, or until it is woken, see wake()
+         */
+        unsigned long idle();
+
+        //-----------------------------------------------------------------------------------
+        /* Set or clear one bit of a slave register with a single function 22 transaction
+         * @param: 
+         *      - packet: MASK_WRITE_REGISTER packet, it should not be in packet array
+         *      - bit: bit number, 0 to 15
+         *      - value: new value of bit
+         *      - priority: priority of one-shot packet
+         * @return: false if queue is full
+         * @api
+         * @comment: AND and OR masks are kept in register array at register_start_address.
+         *           Bit changes made before the packet is sent are merged into one transaction
+         */
+        bool bit_write(Packet *packet, uint8_t bit, bool value, uint8_t priority = 0);
+
+        //-----------------------------------------------------------------------------------
+        /* Set one bit of a slave register
+         * @param: function 22 packet and bit number
+         * @return: false if queue is full
+         * @api
+         * @comment: 
+         */
+        bool bit_set(Packet *packet, uint8_t bit, uint8_t priority = 0)
+        {
+            return bit_write(packet, bit, true, priority);
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Clear one bit of a slave register
+         * @param: function 22 packet and bit number
+         * @return: false if queue is full
+         * @api
+         * @comment: 
+         */
+        bool bit_clear(Packet *packet, uint8_t bit, uint8_t priority = 0)
+        {
+            return bit_write(packet, bit, false, priority);
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Return number of one-shot packets waiting in queue
+         * @param: none
+         * @return: number of packets
+         * @api
+         * @comment: 
+         */
+        uint8_t queued()
+        {
+            return _queue_count;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Return queue latency of last one-shot packet, from send() until it is transmitted
+         * @param: none
+         * @return: time in milisecond
+         * @api
+         * @comment: 
+         */
+        unsigned long queue_latency()
+        {
+            return _queue_latency;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Return maximum queue latency of one-shot packets
+         * @param: none
+         * @return: time in milisecond
+         * @api
+         * @comment: 
+         */
+        unsigned long queue_latency_max()
+        {
+            return _queue_latency_max;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Return number of one-shot packets rejected because queue was full
+         * @param: none
+         * @return: number of packets
+         * @api
+         * @comment: 
+         */
+        uint16_t queue_overflows()
+        {
+            return _queue_overflow;
+        }
         
+#if MODBUS_CAPTURE
+        //-----------------------------------------------------------------------------------
+        /* Start or stop recording frames into capture buffer
+         * @param: true to start recording
+         * @return: none
+         * @api
+         * @comment: oldest records are dropped when capture buffer is full
+         */
+        void capture(bool enable)
+        {
+            _capture_enable = enable;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Return number of bytes recorded in capture buffer
+         * @param: none
+         * @return: number of bytes
+         * @api
+         * @comment: 
+         */
+        uint16_t capture_size()
+        {
+            return _capture_used;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Copy captured records into a linear buffer, oldest record first
+         * @param: buffer and its size
+         * @return: number of bytes copied
+         * @api
+         * @comment: only complete records are copied
+         */
+        uint16_t capture_read(uint8_t* buffer, uint16_t size);
+
+        //-----------------------------------------------------------------------------------
+        /* Write captured records to a stream and clear capture buffer
+         * @param: output, e.g. Serial. On host builds it can be a Print writing to a file
+         * @return: number of bytes written
+         * @api
+         * @comment: 
+         */
+        uint16_t capture_dump(Print* out);
+
+        //-----------------------------------------------------------------------------------
+        /* Clear capture buffer
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: 
+         */
+        void capture_clear()
+        {
+            _capture_head = 0;
+            _capture_tail = 0;
+            _capture_used = 0;
+        }
+#endif
+
+#if MODBUS_TRACE
+        //-----------------------------------------------------------------------------------
+        /* Move trace records into a buffer, oldest record first
+         * @param: buffer and its size
+         * @return: number of bytes copied, TRACE_RECORD bytes per record
+         * @api
+         * @comment: it may run in another task than update(), e.g. to send records
+         *           over Modbus TCP or to an SD card
+         */
+        uint16_t trace_read(uint8_t* buffer, uint16_t size);
+
+        //-----------------------------------------------------------------------------------
+        /* Write trace records to a stream and remove them, oldest record first
+         * @param: output stream, e.g. &Serial
+         * @return: number of bytes written
+         * @api
+         * @comment: records are binary, decode them with extras/trace_decode.py
+         */
+        uint16_t trace_dump(Print* out);
+
+        //-----------------------------------------------------------------------------------
+        /* Return number of events dropped because trace ring was full
+         * @param: none
+         * @return: dropped events
+         * @api
+         */
+        uint16_t trace_lost()
+        {
+            return _trace_lost;
+        }
+#endif
+
+        //-----------------------------------------------------------------------------------
+        /* Replay a capture trace against the frame decoder
+         * @param: 
+         *      - trace: records in capture format
+         *      - size: size of trace in bytes
+         *      - register_array: registers to decode into, at least BUFFER_SIZE/2 registers
+         * @return: number of response frames processed
+         * @api
+         * @comment: each RX record is decoded as response of the TX record before it.
+         *           Call it when no transmission is in progress
+         */
+        uint16_t replay(const uint8_t* trace, uint16_t size, uint16_t* register_array);
+
+        //-----------------------------------------------------------------------------------
+        /* Decode a response frame with the same checks as a live response
+         * @param: 
+         *      - packet: requested packet, its statistics are updated
+         *      - response: response frame with CRC
+         *      - size: size of response frame
+         *      - register_array: registers to decode into
+         * @return: 1 if response is accepted, 0 if it is rejected or ignored
+         * @api
+         * @comment: safe with any input, it is the entry point for fuzzing the decoder.
+         *           Turnaround guards, trace ring and point targets are left as they are.
+         *           Call it when no transmission is in progress
+         */
+        uint8_t decode(Packet* packet, const uint8_t* response, uint8_t size, uint16_t* register_array);
+
     private:
         //Local function
 
+        //Select next packet to send: one-shot packets first, then cyclic packets
+        bool nextPacket();
+
+        //Find one-shot packet in queue
+        uint8_t findQueued(Packet *packet);
+
+        //Put a request into submission queue and call wake function
+        bool enqueue(ModbusRequest *request, ModbusWake wake);
+
+        //Move submitted requests into one-shot queue
+        void drainSubmitted();
+
+        //Finish requests of a packet
+        void finishRequests(Packet *packet, bool success);
+
+        //Select chunk of block transfer
+        bool nextChunk();
+
+        //Prepare chunk of block transfer at its current position
+        void loadChunk();
+
+        //Pass finished chunk to block and move to the next one
+        void finishChunk(bool success);
+
+        //Current transaction is a chunk of block transfer
+        bool blockChunk()
+        {
+            return _block && (_packet == &_block->packet);
+        }
+
+        //Connection status of cyclic packet
+        uint8_t connected(uint16_t index);
+
+        //Get cyclic packet, packet of packet table is loaded into cursor slot
+        Packet* loadPacket(uint16_t index, uint8_t slot);
+
+        //Save state of packet table packets in current transaction
+        void storePackets();
+
+        //Stage a table for reconfigure
+        bool stageTable(Packet* packets, const PacketConfig* config, PacketState* state, bool progmem,
+                        uint16_t total_packets, uint16_t* register_array);
+
+        //Take staged table, state of unchanged packets is carried over
+        void publishTable();
+
+        //Read config and state of a packet of a table, state may be NULL
+        static void readTable(const PacketTable* table, uint16_t index, PacketConfig* config, PacketState* state);
+
+        //Write state of a packet of a table
+        static void writeTable(PacketTable* table, uint16_t index, const PacketState* state);
+
         //Check received packet
         void checkPacket();
 
+        //Check validity of received frame and process the result
+        void processPacket(uint8_t buffer);
+
         //Get response packet
         uint8_t getPacket();
 
@@ -201,12 +994,29 @@ class  Modbus {
         //Construct frame to send
         void constructPacket();
 
+        //Current transaction merges single writes, see coalesce
+        bool coalesced()
+        {
+#if MODBUS_GROUP
+            return (_group_size > 1) &&
+                   ( (_packet->function == PRESET_SINGLE_REGISTER) || (_packet->function == FORCE_SINGLE_COIL) );
+#else
+            return false;
+#endif
+        }
+
         //Construct frame for function 15
         uint8_t construct_F15();
 
         //Construct frame for function 16
         uint8_t construct_F16();
 
+        //Construct frame for function 22
+        uint8_t construct_F22();
+
+        //Construct frame for function 23
+        uint8_t construct_F23();
+
         //Send modbus packet
         void sendPacket(uint8_t bufferSize);
 
@@ -222,12 +1032,22 @@ class  Modbus {
         //Process result for function 1 and 2
         void process_F1_F2();
 
-        //Process result for function 3,4
+        //Process result for function 3,4,23
         void process_F3_F4();
 
-        //Process result for function 5,6,15,16
+        //Process result for function 5,6,15,16,22
         void process_F5_F6_F15_F16();
 
+        //Decode points covered by registers which changed
+        void decodePoints(uint16_t register_start, uint16_t total_registers, uint16_t changed_start, uint16_t changed_end);
+
+        //Mark register changed by a read
+        void markChanged(uint16_t index)
+        {
+            if (index < _total_watched)
+                _changed[index / CHANGE_BITS] |= (ChangeWord)1 << (index % CHANGE_BITS);
+        }
+
         //Update packet error information
         void packetError();
 
@@ -236,6 +1056,35 @@ class  Modbus {
 
         //Measure polling time in auto update mode
         void status();
+
+        //Check gap before sending selected packet in auto update mode
+        bool gapFinished();
+
+        //Size of response to current request, if slave answers without exception
+        uint8_t responseSize();
+
+        //Find turnaround entry of a slave, a new entry is taken when create is true
+        Turnaround* findTurnaround(uint8_t id, bool create);
+
+        //Forget all learned turnaround guards
+        void clearTurnaround()
+        {
+            for (uint8_t i = 0; i < _turnaround_size; i++)
+                _turnaround[i].id = 0;
+        }
+
+        //Grow turnaround guard of a slave on failure, shrink it on success
+        void learnTurnaround(uint8_t id, bool failed);
+
+#if MODBUS_TRACE
+        //Record a protocol event into trace ring
+        void traceEvent(uint8_t event, uint16_t value);
+#endif
+
+#if MODBUS_CAPTURE
+        //Record a frame into capture buffer
+        void captureFrame(uint8_t direction, unsigned long timestamp, uint8_t length);
+#endif
         
         
         long _response_time = 0;
@@ -255,29 +1104,104 @@ class  Modbus {
 
         bool _manual_request = false;   //request by rtos
 
-#if defined(__SAM3X8E__)
-        USARTClass* _modbusPort;    //Serial for ARM - it will not work with Seria0 
+        Stream* _modbusPort;    //Serial port or any stream. On ARM it will not work with Seria0 
+
+        Packet* _packet;    //current packet
+#if MODBUS_GROUP
+        uint8_t _group_size = 1;    //packets served by current transaction, from _packet on
+        bool _fuse = false;         //fuse read/write pairs into function 23
+        bool _coalesce = false;     //merge single writes into function 16 or 15
 #else
-        HardwareSerial* _modbusPort;    //Serial for AVR
+        static const uint8_t _group_size = 1;   //one packet per transaction
 #endif
 
-        Packet* _packet;    //current packet
+        PointMap* _point_maps = NULL;           //typed points on register array, in mapped order
+        PointCallback _point_callback = NULL;   //target of a point changed
+        ChangeWord* _changed = NULL;            //bitmap of changed registers
+        uint16_t _total_watched = 0;            //registers in bitmap
+        ModbusCallback _callback = NULL;    //finished transaction of a packet
 
         uint8_t frame[BUFFER_SIZE]; //frame of packet
 
         uint16_t T1_5;          //1.5 times of a character connection time
+        uint16_t T3_5;          //3.5 times of a character connection time, silence between frames
         uint16_t _frame_delay;   //delay time for frame
+        uint16_t _byte_time;     //time of one character in microsecond
+
+        uint8_t _gap_mode = GAP_FIXED;              //gap between two transactions
+        Turnaround* _turnaround = NULL;             //learned turnaround guards, storage of user
+        uint8_t _turnaround_size = 0;               //number of entries
+        unsigned long _bus_idle;        //micros() when bus was last active
+        unsigned long _request_start;   //millis() when last request was sent
+        bool _gap_hold = false;         //selected packet is waiting for its gap
+        bool _bus_empty = false;        //last update() found no packet to send
+
+        static ModbusClock _system_clock;   //Arduino clock
+        ModbusClock* _clock = &_system_clock;
+
+        ModbusWake _wake_task = NULL;   //wakes task blocked on idle() time, from a task
+        ModbusWake _wake_isr = NULL;    //wakes task blocked on idle() time, from an interrupt
+        void* _wake_arg = NULL;
+        uint8_t _response_size = 0;     //expected size of response to current request
+        volatile bool _rx_notified = false;     //received() is called by port
+        volatile bool _rx_started = false;      //task is woken for first byte of response
+        bool _rx_pending = false;       //response is being received
+        unsigned long _rx_first;        //micros() when first byte of response was seen
 
         uint16_t _total_packets;    //Total number of packets
-        uint16_t* _register_array;  //registers that hold the dater or address of modbus register
+        uint16_t* _register_array = NULL;  //registers that hold the dater or address of modbus register
         Packet* _packet_array;      //All initial packet   
+        const PacketConfig* _packet_config = NULL;  //config of packet table
+        PacketState* _packet_state = NULL;          //runtime state of packet table
+        bool _config_progmem = false;               //config of packet table is in flash
+        Packet _cursor[MAX_GROUP];  //packets of packet table in current transaction
+        uint16_t _cursor_index;     //packet table index of _cursor[0]
+        uint16_t _packet_index = 0; //next cyclic packet to send
+
+        PacketTable _staged_table;          //table waiting for reconfigure
+        volatile uint8_t _staged = 0;       //1 when _staged_table is waiting
+
+        QueuedPacket* _queue = NULL;        //one-shot packets sorted by priority, storage of user
+        uint8_t _queue_size = 0;            //number of queue slots
+        uint8_t _queue_count = 0;           //number of queued one-shot packets
+        Packet* _oneshot = NULL;            //one-shot packet in progress
+        unsigned long _queue_latency = 0;       //queue latency of last one-shot packet
+        unsigned long _queue_latency_max = 0;   //maximum queue latency
+        uint16_t _queue_overflow = 0;           //one-shot packets rejected
+
+        SubmitSlot* _submit = NULL;             //submission queue, many producers and one consumer, storage of user
+        uint8_t _submit_size = 0;               //number of submit slots, power of 2
+        volatile uint8_t _submit_tail = 0;      //next position to fill, shared by producers
+        uint8_t _submit_head = 0;               //next position to take, consumer only
+        ModbusRequest* _requests = NULL;        //requests in progress
+
+        ModbusBlock* _block = NULL;             //block transfer in progress, it holds its current chunk
+        long _block_debt = 0;                   //bus bytes owed to block transfer, it is sent when not negative
 
         bool _transmission_ready_flag = false;  //=1 when transimission is not busy
 
         bool _response_flag = false;    //status of slave response = 1 or not = 0
+        bool _response_ok = false;      //last response was successful
+        uint8_t _request_function;      //function code of request frame
 
         uint16_t _total_request;    //Total packets have requested
         uint16_t _total_fail;   //Total failed packets
+
+#if MODBUS_TRACE
+        TraceRecord _trace[TRACE_RECORDS];  //ring of trace records
+        volatile uint8_t _trace_head = 0;   //next record to write
+        volatile uint8_t _trace_tail = 0;   //oldest record
+        uint16_t _trace_lost = 0;
+        bool _trace_pause = false;          //decode() is running, its events are dropped
+#endif
+
+#if MODBUS_CAPTURE
+        uint8_t _capture[CAPTURE_SIZE]; //ring buffer of capture records
+        uint16_t _capture_head = 0;     //write position
+        uint16_t _capture_tail = 0;     //oldest record
+        uint16_t _capture_used = 0;     //bytes in use
+        bool _capture_enable = false;
+#endif
 };
 
 #endif  //end Header file
@@ -0,0 +1,362 @@
+/*
+Name: Sample historian for ModbusXT
+
+Keeps short-term trends of polled registers in a fixed ring of SRAM. A sample is the
+time, the first register and the values of one successful read. Values are stored as
+zig-zag varint deltas to the previous sample of the same registers, so a value which
+does not change takes one byte.
+
+Ring is split into blocks of HISTORY_BLOCK bytes. First sample of a register in a block
+is stored against 0, so each block decodes on its own. When ring is full the oldest
+block is dropped. A range query skips blocks which end before its start.
+
+Example:
+    uint8_t history_buffer[2048];
+    uint16_t history_state[2 * TOTAL_REGS];
+    ModbusHistory history;
+
+    void answered(Packet* packet, bool success)
+    {
+        if (success)
+            history.record(millis(), packet, regs);
+    }
+
+    history.begin(history_buffer, sizeof(history_buffer), history_state, TOTAL_REGS);
+    master.callback(answered);
+*/
+
+#ifndef MODBUSXT_HISTORY_H_
+#define MODBUSXT_HISTORY_H_
+
+#include "ModbusXT.h"
+
+#ifndef HISTORY_BLOCK
+#define HISTORY_BLOCK 256   //bytes of one block, ring needs at least 2 blocks
+#endif
+
+/*
+Block format:
+    - used: 2 bytes, bytes of block in use including header, low byte first
+    - samples: 2 bytes, samples in block, low byte first
+    - time: 4 bytes, time of first sample, low byte first
+    - samples, each:
+        - varint of time since previous sample of block
+        - varint of first register
+        - 1 byte number of values
+        - varint of zig-zag delta to previous value of register, one per value
+*/
+#define HISTORY_HEADER 8
+#define HISTORY_MAX_VALUES ((HISTORY_BLOCK - HISTORY_HEADER - 9) / 3)   //values of a sample, 79 for 256 byte blocks
+
+//Called for each sample found by ModbusHistory::query
+typedef void (*HistoryCallback)(unsigned long time, uint16_t register_start, const uint16_t* values, uint8_t count, void* arg);
+
+class ModbusHistory {
+    public:
+
+        //-----------------------------------------------------------------------------------
+        /* Start historian
+         * @param:
+         *      - buffer: ring of samples, HISTORY_BLOCK bytes per block
+         *      - size: size of buffer
+         *      - state: 2 * total_registers words, previous values for record and query
+         *      - total_registers: registers of master register array
+         * @return: false if buffer holds less than 2 blocks
+         * @api
+         */
+        bool begin(uint8_t* buffer, uint16_t size, uint16_t* state, uint16_t total_registers)
+        {
+            _buffer = buffer;
+            _total_blocks = size / HISTORY_BLOCK > 255 ? 255 : size / HISTORY_BLOCK;
+            _state = state;
+            _total_registers = total_registers;
+            _head = 0;
+            _tail = 0;
+            _used_blocks = 0;
+            _samples = 0;
+            _dropped = 0;
+            _raw_bytes = 0;
+            _stored_bytes = 0;
+            return _total_blocks >= 2;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Record a sample
+         * @param: time, e.g. millis(), first register, values and number of values
+         * @return: false if registers are outside of master register array or count
+         *          is more than HISTORY_MAX_VALUES
+         * @api
+         * @comment: time may wrap around like millis()
+         */
+        bool record(unsigned long time, uint16_t register_start, const uint16_t* values, uint8_t count)
+        {
+            if ( (_total_blocks < 2) || (count == 0) || (count > HISTORY_MAX_VALUES) ||
+                 (register_start + count > _total_registers) )
+                return false;
+
+            uint8_t* block = &_buffer[(uint16_t)_head * HISTORY_BLOCK];
+            uint16_t bound = 5 + 3 + 1 + 3 * count;     //largest encoded sample
+            if ( (_used_blocks == 0) || (get16(block) + bound > HISTORY_BLOCK) )
+                block = nextBlock(time);
+
+            uint16_t used = get16(block);
+            uint8_t* p = &block[used];
+            p = putVarint(p, (uint32_t)(time - _last_time));
+            p = putVarint(p, register_start);
+            *p++ = count;
+
+            uint16_t* previous = &_state[register_start];
+            for (uint8_t i = 0; i < count; i++)
+            {
+                int16_t delta = values[i] - previous[i];
+                previous[i] = values[i];
+                p = putVarint(p, (uint16_t)(((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15)));    //zig-zag, no shift of a negative value
+            }
+
+            uint16_t size = p - &block[used];
+            put16(block, used + size);
+            put16(&block[2], get16(&block[2]) + 1);
+            _last_time = time;
+
+            _samples++;
+            _raw_bytes += 4 + 2 + 1 + 2 * count;    //time, register, count and values
+            _stored_bytes += size;
+            return true;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Record registers of a successful read
+         * @param: time, packet and master register array
+         * @return: false if packet is not a read
+         * @api
+         * @comment: called from Modbus::callback. Function 1 and 2 record their packed registers
+         */
+        bool record(unsigned long time, const Packet* packet, const uint16_t* register_array)
+        {
+            uint8_t count;
+            switch (packet->function)
+            {
+                case READ_COIL_STATUS:
+                case READ_INPUT_STATUS:
+                    count = (packet->data + 15) / 16;
+                    break;
+                case READ_HOLDING_REGISTERS:
+                case READ_INPUT_REGISTERS:
+                case READ_WRITE_MULTIPLE_REGISTERS:
+                    count = packet->data;
+                    break;
+                default:
+                    return false;
+            }
+            return record(time, packet->register_start_address, &register_array[packet->register_start_address], count);
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Find samples in a time range
+         * @param: first and last time, function called for each sample and its argument
+         * @return: number of samples found
+         * @api
+         * @comment: samples are passed oldest first. Blocks which end before first time
+         *           are not decoded
+         */
+        uint16_t query(unsigned long from, unsigned long to, HistoryCallback callback, void* arg)
+        {
+            uint16_t* values = &_state[_total_registers];
+            uint16_t found = 0;
+
+            for (uint8_t b = 0; b < _used_blocks; b++)
+            {
+                uint8_t* block = &_buffer[(uint16_t)((_tail + b) % _total_blocks) * HISTORY_BLOCK];
+                uint32_t time = get32(&block[4]);
+                if ( (int32_t)(time - to) > 0 )
+                    break;
+
+                //Samples of block are not later than first sample of next block
+                if (b + 1 < _used_blocks)
+                {
+                    uint8_t* next = &_buffer[(uint16_t)((_tail + b + 1) % _total_blocks) * HISTORY_BLOCK];
+                    if ( (int32_t)(get32(&next[4]) - from) < 0 )
+                        continue;
+                }
+
+                memset(values, 0, _total_registers * sizeof(uint16_t));
+                const uint8_t* p = &block[HISTORY_HEADER];
+                const uint8_t* end = &block[get16(block)];
+                while (p < end)
+                {
+                    uint32_t value;
+                    p = getVarint(p, &value);
+                    time += value;
+                    p = getVarint(p, &value);
+                    uint16_t register_start = value;
+                    uint8_t count = *p++;
+
+                    for (uint8_t i = 0; i < count; i++)
+                    {
+                        p = getVarint(p, &value);
+                        values[register_start + i] += (uint16_t)((value >> 1) ^ -(value & 1));
+                    }
+
+                    if ( ((int32_t)(time - from) >= 0) && ((int32_t)(time - to) <= 0) )
+                    {
+                        callback(time, register_start, &values[register_start], count, arg);
+                        found++;
+                    }
+                }
+            }
+            return found;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Write all blocks, oldest first
+         * @param: output, e.g. Serial
+         * @return: number of bytes written
+         * @api
+         * @comment: blocks are written in block format, extras/history_decode.py decodes them
+         */
+        uint16_t dump(Print* out)
+        {
+            uint16_t written = 0;
+            for (uint8_t b = 0; b < _used_blocks; b++)
+            {
+                uint8_t* block = &_buffer[(uint16_t)((_tail + b) % _total_blocks) * HISTORY_BLOCK];
+                written += out->write(block, get16(block));
+            }
+            return written;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Statistics
+         * @param: none
+         * @return:
+         *      - samples: samples recorded
+         *      - dropped: samples dropped with oldest blocks
+         *      - raw_bytes: bytes of samples as time, register, count and 16 bit values
+         *      - stored_bytes: bytes of encoded samples, raw_bytes / stored_bytes is the compression ratio
+         *      - used: bytes of ring in use
+         *      - span: time from oldest to newest sample
+         * @api
+         */
+        uint32_t samples()
+        {
+            return _samples;
+        }
+
+        uint32_t dropped()
+        {
+            return _dropped;
+        }
+
+        uint32_t raw_bytes()
+        {
+            return _raw_bytes;
+        }
+
+        uint32_t stored_bytes()
+        {
+            return _stored_bytes;
+        }
+
+        uint16_t used()
+        {
+            uint16_t total = 0;
+            for (uint8_t b = 0; b < _used_blocks; b++)
+                total += get16(&_buffer[(uint16_t)((_tail + b) % _total_blocks) * HISTORY_BLOCK]);
+            return total;
+        }
+
+        unsigned long span()
+        {
+            if (_used_blocks == 0)
+                return 0;
+            return (uint32_t)(_last_time - get32(&_buffer[(uint16_t)_tail * HISTORY_BLOCK + 4]));
+        }
+
+    private:
+
+        //Start next block, oldest block is dropped when ring is full
+        uint8_t* nextBlock(unsigned long time)
+        {
+            if (_used_blocks)
+                _head = (_head + 1) % _total_blocks;
+
+            if (_used_blocks == _total_blocks)
+            {
+                _dropped += get16(&_buffer[(uint16_t)_tail * HISTORY_BLOCK + 2]);
+                _tail = (_tail + 1) % _total_blocks;
+            }
+            else
+                _used_blocks++;
+
+            uint8_t* block = &_buffer[(uint16_t)_head * HISTORY_BLOCK];
+            put16(block, HISTORY_HEADER);
+            put16(&block[2], 0);
+            put32(&block[4], time);
+            _last_time = time;
+
+            memset(_state, 0, _total_registers * sizeof(uint16_t));    //first samples are stored against 0
+            return block;
+        }
+
+        static uint8_t* putVarint(uint8_t* p, uint32_t value)
+        {
+            while (value >= 0x80)
+            {
+                *p++ = value | 0x80;
+                value >>= 7;
+            }
+            *p++ = value;
+            return p;
+        }
+
+        static const uint8_t* getVarint(const uint8_t* p, uint32_t* value)
+        {
+            uint32_t result = 0;
+            uint8_t shift = 0;
+            while (*p & 0x80)
+            {
+                result |= (uint32_t)(*p++ & 0x7F) << shift;
+                shift += 7;
+            }
+            *value = result | ((uint32_t)*p++ << shift);
+            return p;
+        }
+
+        static uint16_t get16(const uint8_t* p)
+        {
+            return p[0] | (p[1] << 8);
+        }
+
+        static void put16(uint8_t* p, uint16_t value)
+        {
+            p[0] = value & 0xFF;
+            p[1] = value >> 8;
+        }
+
+        static uint32_t get32(const uint8_t* p)
+        {
+            return (uint32_t)get16(p) | ((uint32_t)get16(&p[2]) << 16);
+        }
+
+        static void put32(uint8_t* p, uint32_t value)
+        {
+            put16(p, value & 0xFFFF);
+            put16(&p[2], value >> 16);
+        }
+
+        uint8_t* _buffer;
+        uint8_t _total_blocks;
+        uint8_t _head;          //block being written
+        uint8_t _tail;          //oldest block
+        uint8_t _used_blocks;
+        uint16_t* _state;       //previous values of record, then scratch values of query
+        uint16_t _total_registers;
+        uint32_t _last_time;    //time of newest sample
+
+        uint32_t _samples;
+        uint32_t _dropped;
+        uint32_t _raw_bytes;
+        uint32_t _stored_bytes;
+};
+
+#endif  //end Header file
@@ -0,0 +1,239 @@
+/*
+Name: Blocking wait for ModbusXT under an RTOS
+
+A task which runs the master can sleep instead of polling update() in a loop.
+The master tells how long it has nothing to do, see Modbus::idle(), and wakes the
+task earlier when a request is submitted or a response is received.
+
+Backend is selected from the RTOS header included before this file, or by MODBUS_OS:
+    - MODBUS_OS_NILRTOS: NilRTOS semaphore
+    - MODBUS_OS_FREERTOS: FreeRTOS binary semaphore
+    - MODBUS_OS_POSIX: pthread mutex and condition variable on the monotonic clock
+
+Example:
+    ModbusEvent event;
+
+    void modbusTask()
+    {
+        event.begin();
+        master.wake(ModbusEvent::wake, ModbusEvent::wakeFromISR, &event);
+        while (1)
+        {
+            master.update();
+            event.wait(master.idle());
+        }
+    }
+
+    //other tasks
+    master.submit(&request);
+
+    //serial receive interrupt, optional
+    master.received();
+
+submit() calls the first function of Modbus::wake, submitFromISR() and received() call
+the second one, so neither needs a critical section around it. When received() is called
+from a task, e.g. a driver callback, pass ModbusEvent::wake for both.
+POSIX has no interrupts: both functions are for threads, neither is safe in a signal handler.
+*/
+
+#ifndef MODBUSXT_OS_H_
+#define MODBUSXT_OS_H_
+
+#include "ModbusXT.h"
+
+#define MODBUS_OS_NILRTOS 1
+#define MODBUS_OS_FREERTOS 2
+#define MODBUS_OS_POSIX 3
+
+#ifndef MODBUS_OS
+#if defined(_NIL_H_) || defined(NIL_H)
+#define MODBUS_OS MODBUS_OS_NILRTOS
+#elif defined(INC_FREERTOS_H)
+#define MODBUS_OS MODBUS_OS_FREERTOS
+#elif defined(__unix__) || defined(__APPLE__)
+#define MODBUS_OS MODBUS_OS_POSIX
+#else
+#error "ModbusXT_OS.h: include NilRTOS or FreeRTOS first, or define MODBUS_OS"
+#endif
+#endif
+
+#if MODBUS_OS == MODBUS_OS_NILRTOS
+#ifndef MODBUS_NIL_SEMAPHORE
+#define MODBUS_NIL_SEMAPHORE Semaphore  //semaphore_t in later Nil versions
+#endif
+#elif MODBUS_OS == MODBUS_OS_POSIX
+#include <pthread.h>
+#include <time.h>
+#endif
+
+class ModbusEvent {
+    public:
+
+        //-----------------------------------------------------------------------------------
+        /* Create event, it is not signaled
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: call it before the event is passed to Modbus::wake
+         */
+        void begin()
+        {
+#if MODBUS_OS == MODBUS_OS_NILRTOS
+            nilSemInit(&_semaphore, 0);
+#elif MODBUS_OS == MODBUS_OS_FREERTOS
+            _semaphore = xSemaphoreCreateBinary();
+#else
+            pthread_mutex_init(&_mutex, NULL);
+#if defined(__APPLE__)
+            pthread_cond_init(&_cond, NULL);  //waits are relative, see wait
+#else
+            pthread_condattr_t attr;
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);    //deadline does not move with wall clock
+            pthread_cond_init(&_cond, &attr);
+            pthread_condattr_destroy(&attr);
+#endif
+            _signaled = false;
+#endif
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Signal event from a task, many signals before a wait count as one
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: not for interrupts, see signalFromISR. A woken task with higher
+         *           priority runs before signal returns
+         */
+        void signal()
+        {
+#if MODBUS_OS == MODBUS_OS_NILRTOS
+            nilSysLock();
+            if (_semaphore.cnt < 1)
+            {
+                nilSemSignalI(&_semaphore);
+                nilSchRescheduleS();
+            }
+            nilSysUnlock();
+#elif MODBUS_OS == MODBUS_OS_FREERTOS
+            xSemaphoreGive(_semaphore);     //binary semaphore, a second give fails
+#else
+            pthread_mutex_lock(&_mutex);
+            _signaled = true;
+            pthread_cond_signal(&_cond);
+            pthread_mutex_unlock(&_mutex);
+#endif
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Signal event from an interrupt, many signals before a wait count as one
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: a woken task with higher priority runs when the interrupt returns.
+         *           NilRTOS reschedules in the interrupt epilogue, NIL_IRQ_EPILOGUE()
+         *           of the handler. On POSIX it is signal(), for threads only
+         */
+        void signalFromISR()
+        {
+#if MODBUS_OS == MODBUS_OS_NILRTOS
+            nilSysLockFromIsr();
+            if (_semaphore.cnt < 1)
+                nilSemSignalI(&_semaphore);
+            nilSysUnlockFromIsr();
+#elif MODBUS_OS == MODBUS_OS_FREERTOS
+            BaseType_t woken = pdFALSE;
+            xSemaphoreGiveFromISR(_semaphore, &woken);
+            portYIELD_FROM_ISR(woken);
+#else
+            signal();
+#endif
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Wait until event is signaled or time is over
+         * @param: time in microsecond, e.g. Modbus::idle(). 0 only takes a pending signal
+         * @return: true if event was signaled
+         * @api
+         * @comment: time is rounded up to the tick of RTOS
+         */
+        bool wait(unsigned long timeout)
+        {
+#if MODBUS_OS == MODBUS_OS_NILRTOS
+            systime_t ticks = TIME_IMMEDIATE;
+            if (timeout)
+                ticks = ((uint64_t)timeout * NIL_CFG_FREQUENCY + 999999) / 1000000;
+            return nilSemWaitTimeout(&_semaphore, ticks) == NIL_MSG_OK;
+#elif MODBUS_OS == MODBUS_OS_FREERTOS
+            TickType_t ticks = ((uint64_t)timeout * configTICK_RATE_HZ + 999999) / 1000000;
+            return xSemaphoreTake(_semaphore, ticks) == pdTRUE;
+#else
+            timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += timeout / 1000000;
+            deadline.tv_nsec += (timeout % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            pthread_mutex_lock(&_mutex);
+            while (!_signaled && timeout)
+            {
+#if defined(__APPLE__)
+                //No monotonic condition variable, wait for the time left
+                timespec now, left;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                left.tv_sec = deadline.tv_sec - now.tv_sec;
+                left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+                if (left.tv_nsec < 0)
+                {
+                    left.tv_sec--;
+                    left.tv_nsec += 1000000000;
+                }
+                if (left.tv_sec < 0 || pthread_cond_timedwait_relative_np(&_cond, &_mutex, &left) != 0)
+                    break;  //time is over
+#else
+                if (pthread_cond_timedwait(&_cond, &_mutex, &deadline) != 0)
+                    break;  //time is over
+#endif
+            }
+            bool signaled = _signaled;
+            _signaled = false;
+            pthread_mutex_unlock(&_mutex);
+            return signaled;
+#endif
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Wake functions for Modbus::wake
+         * @param: event
+         * @return: none
+         * @api
+         * @comment: wake is the task function, wakeFromISR the interrupt function
+         */
+        static void wake(void* event)
+        {
+            ((ModbusEvent*)event)->signal();
+        }
+
+        static void wakeFromISR(void* event)
+        {
+            ((ModbusEvent*)event)->signalFromISR();
+        }
+
+    private:
+
+#if MODBUS_OS == MODBUS_OS_NILRTOS
+        MODBUS_NIL_SEMAPHORE _semaphore;
+#elif MODBUS_OS == MODBUS_OS_FREERTOS
+        SemaphoreHandle_t _semaphore;
+#else
+        pthread_mutex_t _mutex;
+        pthread_cond_t _cond;
+        bool _signaled;
+#endif
+};
+
+#endif  //end Header file
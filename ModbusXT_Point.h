@@ -0,0 +1,219 @@
+/*
+Name: Typed point mapping for ModbusXT
+
+A point is a value of an application struct which is decoded from one or two
+registers of the master register array. Decoders are template functions, so
+type, word order and byte order are all fixed at compile time.
+
+Example:
+    struct { int32_t energy; float power; float temperature; } meter;
+
+    Point meter_points[] = {
+        modbusPoint<int32_t, ORDER_CDAB>("energy", 0, meter.energy),
+        modbusPoint<float, ORDER_ABCD>("power", 2, meter.power),
+        modbusPoint<int16_t, ORDER_ABCD>("temperature", 4, meter.temperature, 0.1),
+    };
+    PointMap meter_map;
+
+    master.map(&meter_map, meter_points, 3, 0);   //points start at regs[0]
+
+Scale is applied before the value is converted to the type of target, so a scaled
+point keeps its fraction only in a float target: raw 235 with scale 0.1 is 23.5 in a
+float, 23 in an int16_t.
+
+A point is decoded when one of its registers has changed. With a deadband the target
+keeps the last reported value until the new value moves further than the deadband:
+    modbusPoint<float, ORDER_ABCD>("power", 2, meter.power, 1.0, 5, DEADBAND_PERCENT)
+
+Modbus::notify sets a function which is called for each point whose target changed.
+*/
+
+#ifndef MODBUSXT_POINT_H_
+#define MODBUSXT_POINT_H_
+
+#include <Arduino.h>
+
+//Word and byte order of a point. A is the most significant byte
+#define ORDER_ABCD 0    //high word first, high byte first (Modbus default)
+#define ORDER_CDAB 1    //low word first
+#define ORDER_BADC 2    //high word first, bytes swapped in each word
+#define ORDER_DCBA 3    //low word first, bytes swapped in each word
+
+//Deadband of a point
+#define DEADBAND_ABSOLUTE 0 //deadband is in units of target
+#define DEADBAND_PERCENT 1  //deadband is in percent of last reported value
+
+struct Point;
+
+//Decode point into its target, return true if target changed
+typedef bool (*PointDecoder)(const uint16_t* registers, const struct Point* point);
+
+typedef struct Point {
+    const char*     name;
+    uint16_t        offset;     //first register of point, relative to start of map
+    uint8_t         size;       //number of registers, 1 or 2
+    PointDecoder    decode;
+    void*           target;     //application variable
+    float           scale;      //raw value is multiplied by scale
+    float           deadband;   //smaller changes keep target, 0 takes every change
+    uint8_t         deadband_mode;  //DEADBAND_ABSOLUTE or DEADBAND_PERCENT
+} Point;
+
+//Called when target of a point changed, see Modbus::notify
+typedef void (*PointCallback)(const Point* point);
+
+//Points on registers of the master, kept by application, see Modbus::map
+typedef struct PointMap {
+    const Point*    points;
+    uint8_t         total_points;
+    uint16_t        register_start;     //first register of map in master register array
+
+    struct PointMap* next;  //maps of master, used by master
+} PointMap;
+
+//Swap bytes of a register
+inline uint16_t pointSwap(uint16_t value)
+{
+    return (value << 8) | (value >> 8);
+}
+
+//-----------------------------------------------------------------------------------
+/* Raw value of a point, specialized by type and order
+ * @param: first register of point
+ * @return: raw value
+ * @private
+ */
+template<uint8_t order> struct PointWords;
+
+template<> struct PointWords<ORDER_ABCD> {
+    static uint16_t word(const uint16_t* r) { return r[0]; }
+    static uint32_t join(const uint16_t* r) { return ((uint32_t)r[0] << 16) | r[1]; }
+};
+
+template<> struct PointWords<ORDER_CDAB> {
+    static uint16_t word(const uint16_t* r) { return r[0]; }
+    static uint32_t join(const uint16_t* r) { return ((uint32_t)r[1] << 16) | r[0]; }
+};
+
+template<> struct PointWords<ORDER_BADC> {
+    static uint16_t word(const uint16_t* r) { return pointSwap(r[0]); }
+    static uint32_t join(const uint16_t* r) { return ((uint32_t)pointSwap(r[0]) << 16) | pointSwap(r[1]); }
+};
+
+template<> struct PointWords<ORDER_DCBA> {
+    static uint16_t word(const uint16_t* r) { return pointSwap(r[0]); }
+    static uint32_t join(const uint16_t* r) { return ((uint32_t)pointSwap(r[1]) << 16) | pointSwap(r[0]); }
+};
+
+template<typename Raw, uint8_t order> struct PointRaw;
+
+template<uint8_t order> struct PointRaw<uint16_t, order> {
+    static uint16_t get(const uint16_t* r) { return PointWords<order>::word(r); }
+};
+
+template<uint8_t order> struct PointRaw<int16_t, order> {
+    static int16_t get(const uint16_t* r) { return (int16_t)PointWords<order>::word(r); }
+};
+
+template<uint8_t order> struct PointRaw<uint32_t, order> {
+    static uint32_t get(const uint16_t* r) { return PointWords<order>::join(r); }
+};
+
+template<uint8_t order> struct PointRaw<int32_t, order> {
+    static int32_t get(const uint16_t* r) { return (int32_t)PointWords<order>::join(r); }
+};
+
+template<uint8_t order> struct PointRaw<float, order> {
+    static float get(const uint16_t* r)
+    {
+        uint32_t bits = PointWords<order>::join(r);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+//-----------------------------------------------------------------------------------
+/* Store new value of a point into its target
+ * @param: point and new value
+ * @return: true if target changed
+ * @private
+ * @comment: deadband is only calculated in float when value differs
+ */
+template<typename Target>
+bool pointUpdate(const Point* point, Target value)
+{
+    Target* target = (Target*)point->target;
+    if (value == *target)
+        return false;
+
+    if (point->deadband > 0)
+    {
+        float band = point->deadband;
+        if (point->deadband_mode == DEADBAND_PERCENT)
+            band = fabs((float)*target) * point->deadband / 100;
+        if (fabs((float)value - (float)*target) <= band)
+            return false;
+    }
+
+    *target = value;
+    return true;
+}
+
+//-----------------------------------------------------------------------------------
+/* Decode a point into application variable
+ * @param: first register of point and point
+ * @return: true if target changed
+ * @private
+ * @comment: decodeScaledPoint is only used when a scale is given
+ */
+template<typename Raw, uint8_t order, typename Target>
+bool decodePoint(const uint16_t* registers, const Point* point)
+{
+    return pointUpdate(point, (Target)PointRaw<Raw, order>::get(registers));
+}
+
+template<typename Raw, uint8_t order, typename Target>
+bool decodeScaledPoint(const uint16_t* registers, const Point* point)
+{
+    return pointUpdate(point, (Target)(PointRaw<Raw, order>::get(registers) * point->scale));
+}
+
+//-----------------------------------------------------------------------------------
+/* Construct a point
+ * @param:
+ *      - Raw: type on the bus, uint16_t, int16_t, uint32_t, int32_t or float
+ *      - order: ORDER_ABCD, ORDER_CDAB, ORDER_BADC or ORDER_DCBA
+ *      - name: name of point
+ *      - offset: first register of point, relative to start of map
+ *      - target: application variable
+ *      - scale: optional, raw value is multiplied by scale, then converted to target
+ *      - deadband: optional, smaller changes of value are not stored into target
+ *      - mode: DEADBAND_ABSOLUTE or DEADBAND_PERCENT
+ * @return: point
+ * @api
+ * @comment: none
+ */
+template<typename Raw, uint8_t order, typename Target>
+Point modbusPoint(const char* name, uint16_t offset, Target& target)
+{
+    Point point = { name, offset, sizeof(Raw) / 2, &decodePoint<Raw, order, Target>, &target, 1.0f, 0, DEADBAND_ABSOLUTE };
+    return point;
+}
+
+template<typename Raw, uint8_t order, typename Target>
+Point modbusPoint(const char* name, uint16_t offset, Target& target, float scale)
+{
+    Point point = { name, offset, sizeof(Raw) / 2, &decodeScaledPoint<Raw, order, Target>, &target, scale, 0, DEADBAND_ABSOLUTE };
+    return point;
+}
+
+template<typename Raw, uint8_t order, typename Target>
+Point modbusPoint(const char* name, uint16_t offset, Target& target, float scale, float deadband, uint8_t mode = DEADBAND_ABSOLUTE)
+{
+    PointDecoder decode = (scale == 1.0f) ? &decodePoint<Raw, order, Target> : &decodeScaledPoint<Raw, order, Target>;
+    Point point = { name, offset, sizeof(Raw) / 2, decode, &target, scale, deadband, mode };
+    return point;
+}
+
+#endif  //end Header file
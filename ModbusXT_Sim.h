@@ -0,0 +1,418 @@
+/*
+Name: Simulated Modbus RTU bus for ModbusXT
+
+A Stream that hosts many virtual slaves, so the master can be load tested
+without any RS485 hardware. Connect it with Modbus::begin(Stream*, ...).
+Each slave has its own response latency range and fault rates.
+
+With ModbusVirtualClock master and bus run in virtual time. Nothing waits, the clock
+jumps to the next timeout, gap or response, so hours of bus traffic take seconds.
+Fault injection uses random(), a run is repeated with the same randomSeed().
+*/
+
+#ifndef MODBUSXT_SIM_H_
+#define MODBUSXT_SIM_H_
+
+#include "ModbusXT.h"
+
+typedef struct {
+    uint8_t     id;                 //slave ID
+    uint16_t    latency_min;        //minimum response latency in microsecond
+    uint16_t    latency_max;        //maximum response latency in microsecond
+    uint8_t     crc_error;          //percent of responses with corrupted CRC
+    uint8_t     truncate;           //percent of responses cut short
+    uint8_t     silent;             //percent of requests without response, 100 is a dead device
+    uint16_t    turnaround;         //silence in microsecond the slave needs after bus activity, earlier requests are missed
+
+    //Simulation information
+    uint16_t    requests;
+    uint16_t    faults;
+} SimSlave;
+
+class ModbusSimBus : public Stream {
+    public:
+
+        //-----------------------------------------------------------------------------------
+        /* Config simulated bus
+         * @param:
+         *      - slaves: virtual slaves on the bus
+         *      - total_slaves: number of slaves
+         *      - registers: holding/input register image shared by all slaves
+         *      - total_registers: number of registers in image
+         *      - baud: used to model byte time on the bus
+         * @return: none
+         * @api
+         * @comment: coils are read from bit 0 of the register image
+         */
+        void begin(SimSlave* slaves, uint16_t total_slaves, uint16_t* registers, uint16_t total_registers, long baud)
+        {
+            _slaves = slaves;
+            _total_slaves = total_slaves;
+            _registers = registers;
+            _total_registers = total_registers;
+            _byte_time = 11000000UL / baud;    //8E1 = 11 bits per byte
+            _request_size = 0;
+            _response_size = 0;
+            _response_index = 0;
+            _bus_end = now();
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Set time source of bus
+         * @param: clock, NULL for the Arduino clock
+         * @return: none
+         * @api
+         * @comment: set the same clock as master, before begin()
+         */
+        void clock(ModbusClock* clock)
+        {
+            _clock = clock;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Time until pending response is completely received
+         * @param: none
+         * @return: time in microsecond, 0 if no response is on its way
+         * @api
+         */
+        unsigned long pending()
+        {
+            if (_response_index == _response_size)
+                return 0;
+            long remaining = _response_time - now();
+            return remaining > 0 ? remaining : 0;
+        }
+
+        //Request bytes from master
+        size_t write(uint8_t data)
+        {
+            if (_request_size < BUFFER_SIZE)
+                _request[_request_size++] = data;
+            return 1;
+        }
+
+        //Master flushes after the last byte of a request
+        void flush()
+        {
+            respond();
+            _request_size = 0;
+            if (_response_size == 0)
+                _bus_end = now();
+        }
+
+        //Response bytes are only available after latency and transmission time
+        int available()
+        {
+            if ( (long)(now() - _response_time) < 0 )
+                return 0;
+            return _response_size - _response_index;
+        }
+
+        int read()
+        {
+            if (!available())
+                return -1;
+            return _response[_response_index++];
+        }
+
+        int peek()
+        {
+            if (!available())
+                return -1;
+            return _response[_response_index];
+        }
+
+        using Print::write;
+
+    private:
+
+        //Build response of addressed slave and inject faults
+        void respond()
+        {
+            _response_size = 0;
+            _response_index = 0;
+
+            if (_request_size < 8 || crc(_request, _request_size) != 0)
+                return;
+
+            SimSlave* slave = NULL;
+            for (uint16_t i = 0; i < _total_slaves; i++)
+            {
+                if (_slaves[i].id == _request[0])
+                {
+                    slave = &_slaves[i];
+                    break;
+                }
+            }
+            if (slave == NULL)
+                return;
+
+            slave->requests++;
+
+            //Receiver of slave is not ready yet
+            if ( (long)(now() - _bus_end) < (long)slave->turnaround )
+            {
+                slave->faults++;
+                return;
+            }
+
+            if ( (uint8_t)random(100) < slave->silent )
+            {
+                slave->faults++;
+                return;
+            }
+
+            uint8_t function = _request[1];
+            uint16_t address = (_request[2] << 8) | _request[3];
+            uint16_t data = (_request[4] << 8) | _request[5];
+
+            _response[0] = _request[0];
+            _response[1] = function;
+            uint8_t size = 2;
+
+            switch (function)
+            {
+                case READ_COIL_STATUS:
+                case READ_INPUT_STATUS:
+                {
+                    uint8_t no_of_bytes = (data + 7) / 8;
+                    _response[size++] = no_of_bytes;
+                    for (uint8_t i = 0; i < no_of_bytes; i++)
+                    {
+                        uint8_t bits = 0;
+                        for (uint8_t j = 0; j < 8 && (i * 8 + j) < data; j++)
+                            if (reg(address + i * 8 + j) & 1)
+                                bits |= 1 << j;
+                        _response[size++] = bits;
+                    }
+                    break;
+                }
+                case READ_HOLDING_REGISTERS:
+                case READ_INPUT_REGISTERS:
+                    if (data * 2 + 5 > BUFFER_SIZE)
+                    {
+                        size = exception(3);    //illegal data value
+                        break;
+                    }
+                    size = readRegisters(address, data);
+                    break;
+                case FORCE_MULTIPLE_COILS:
+                case PRESET_MULTIPLE_REGISTERS:
+                {
+                    //Byte count and frame size need to match number of coils or registers
+                    uint16_t no_of_bytes = (function == FORCE_MULTIPLE_COILS) ? (data + 7) / 8 : data * 2;
+                    if ( (_request[6] != no_of_bytes) || (_request_size != 9 + no_of_bytes) )
+                    {
+                        size = exception(3);
+                        break;
+                    }
+                    if (function == PRESET_MULTIPLE_REGISTERS)
+                        writeRegisters(address, data, &_request[7]);
+                    for (uint8_t i = 2; i < 6; i++)     //echo address and data
+                        _response[size++] = _request[i];
+                    break;
+                }
+                case FORCE_SINGLE_COIL:
+                case PRESET_SINGLE_REGISTER:
+                    if (function == PRESET_SINGLE_REGISTER)
+                        setReg(address, data);
+                    for (uint8_t i = 2; i < 6; i++)     //echo address and data
+                        _response[size++] = _request[i];
+                    break;
+                case READ_WRITE_MULTIPLE_REGISTERS:
+                {
+                    //Write is done before read, data is number of registers to read
+                    uint16_t write_address = (_request[6] << 8) | _request[7];
+                    uint16_t write_count = (_request[8] << 8) | _request[9];
+                    if ( (_request_size < 13) || (_request[10] != write_count * 2) ||
+                         (_request_size != 13 + write_count * 2) || (data * 2 + 5 > BUFFER_SIZE) )
+                    {
+                        size = exception(3);
+                        break;
+                    }
+                    writeRegisters(write_address, write_count, &_request[11]);
+                    size = readRegisters(address, data);
+                    break;
+                }
+                case MASK_WRITE_REGISTER:
+                {
+                    uint16_t or_mask = (_request[6] << 8) | _request[7];
+                    setReg(address, (reg(address) & data) | (or_mask & ~data));
+                    for (uint8_t i = 2; i < 8; i++)     //echo address and masks
+                        _response[size++] = _request[i];
+                    break;
+                }
+                default:
+                    size = exception(1);    //illegal function
+            }
+
+            uint16_t crc16 = crc(_response, size);
+            _response[size++] = crc16 & 0xFF;
+            _response[size++] = crc16 >> 8;
+
+            if ( (uint8_t)random(100) < slave->crc_error )
+            {
+                _response[size - 1] ^= 0x5A;
+                slave->faults++;
+            }
+            else if ( (uint8_t)random(100) < slave->truncate )
+            {
+                size = random(1, size);
+                slave->faults++;
+            }
+
+            _response_size = size;
+            _response_time = now() + random(slave->latency_min, slave->latency_max + 1) + size * _byte_time;
+            _bus_end = _response_time;
+        }
+
+        //Exception response, return its size without CRC
+        uint8_t exception(uint8_t code)
+        {
+            _response[1] |= 0x80;
+            _response[2] = code;
+            return 3;
+        }
+
+        //Byte count and registers of a read response, return its size without CRC
+        uint8_t readRegisters(uint16_t address, uint16_t count)
+        {
+            uint8_t size = 2;
+            _response[size++] = count * 2;
+            for (uint16_t i = 0; i < count; i++)
+            {
+                uint16_t value = reg(address + i);
+                _response[size++] = value >> 8;
+                _response[size++] = value & 0xFF;
+            }
+            return size;
+        }
+
+        //Registers of a write request, high byte first
+        void writeRegisters(uint16_t address, uint16_t count, const uint8_t* values)
+        {
+            for (uint16_t i = 0; i < count; i++)
+                setReg(address + i, (values[i * 2] << 8) | values[i * 2 + 1]);
+        }
+
+        unsigned long now()
+        {
+            return _clock ? _clock->micros() : micros();
+        }
+
+        uint16_t reg(uint16_t address)
+        {
+            return _registers[address % _total_registers];
+        }
+
+        void setReg(uint16_t address, uint16_t value)
+        {
+            _registers[address % _total_registers] = value;
+        }
+
+        //CRC16 in transmission order, 0 when frame with its CRC is valid
+        static uint16_t crc(const uint8_t* data, uint8_t size)
+        {
+            uint16_t temp = 0xFFFF;
+            for (uint8_t i = 0; i < size; i++)
+            {
+                temp ^= data[i];
+                for (uint8_t j = 0; j < 8; j++)
+                {
+                    if (temp & 0x0001)
+                        temp = (temp >> 1) ^ 0xA001;
+                    else
+                        temp >>= 1;
+                }
+            }
+            return temp;
+        }
+
+        ModbusClock* _clock = NULL;
+        SimSlave* _slaves;
+        uint16_t _total_slaves;
+        uint16_t* _registers;
+        uint16_t _total_registers;
+        unsigned long _byte_time;   //time of one byte on the bus in microsecond
+
+        uint8_t _request[BUFFER_SIZE];
+        uint8_t _request_size;
+
+        uint8_t _response[BUFFER_SIZE];
+        uint8_t _response_size;
+        uint8_t _response_index;
+        unsigned long _response_time;   //time when response is completely received
+        unsigned long _bus_end;         //time when last frame on the bus ended
+};
+
+/*
+Virtual time for master and simulated bus. Time only moves by advance(), by delays of
+master and by step(), which jumps to the next event.
+*/
+class ModbusVirtualClock : public ModbusClock {
+    public:
+
+        //-----------------------------------------------------------------------------------
+        /* Start virtual time at 0
+         * @param: none
+         * @return: none
+         * @api
+         * @comment: call it before begin() of master and bus, then a run with the same
+         *           seed is repeated exactly
+         */
+        void begin()
+        {
+            _now = 0;
+        }
+
+        unsigned long millis()
+        {
+            return _now / 1000;
+        }
+
+        unsigned long micros()
+        {
+            return (unsigned long)_now;
+        }
+
+        void delayMicroseconds(unsigned int time)
+        {
+            _now += time;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Move time forward
+         * @param: time in microsecond
+         * @return: none
+         * @api
+         */
+        void advance(unsigned long time)
+        {
+            _now += time;
+        }
+
+        //-----------------------------------------------------------------------------------
+        /* Run master once and jump to its next event
+         * @param: master and bus which use this clock
+         * @return: none
+         * @api
+         * @comment: next event is the earlier of Modbus::idle() and the pending response.
+         *           Time moves at least 1 microsecond, the cost of one update()
+         */
+        void step(Modbus* master, ModbusSimBus* bus)
+        {
+            master->update();
+
+            unsigned long wait = master->idle();
+            unsigned long response = bus->pending();
+            if (response && response < wait)
+                wait = response;
+            _now += wait ? wait : 1;
+        }
+
+    private:
+
+        uint64_t _now = 0;  //millis() and micros() wrap like the Arduino clock
+};
+
+#endif  //end Header file
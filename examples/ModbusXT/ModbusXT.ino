@@ -46,6 +46,10 @@ uint16_t regs[TOTAL_REGS];
 //Modbus packet
 Packet packets[NO_OF_PACKET];
 
+//One-shot packet and storage of one-shot queue, send() needs queue() to be called first
+Packet echo_packet;
+QueuedPacket queue_slots[1];
+
 // Access individual packet parameter. Uncomment it if you know what you're doing
 // packetPointer packet1 = &packets[PACKET1];
 // packetPointer packet2 = &packets[PACKET2];
@@ -72,6 +76,14 @@ void setup()
 
   master.construct(&packets[PACKET2], hmiID, PRESET_MULTIPLE_REGISTERS, 100, 9, 6);
 
+  //Echo number entry to HMI register 110, sent once by send()
+  master.construct(&echo_packet, hmiID, PRESET_SINGLE_REGISTER, 110, 0, number_entry);
+  master.queue(queue_slots, 1);
+
+  //Send PACKET1 and PACKET2 as one function 23 transaction. Uncomment it if your slave supports function 23
+  //and MODBUS_GROUP is set to 1 in ModbusXT.h
+  // master.fuse(true);
+
   //Start Modbus
   master.begin(&Serial1, BAUD, BYTE_FORMAT, TIMEOUT, POLLING, RETRIES, TxEnablePin);
 
@@ -117,6 +129,7 @@ void loop()
     num = regs[number_entry];
     print("Number: ");
     println(num);
+    master.send(&echo_packet);  //ahead of cyclic packets
   }
 
   //Print slider value on HMI
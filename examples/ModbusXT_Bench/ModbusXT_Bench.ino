@@ -0,0 +1,155 @@
+//Benchmark and robustness test of the response decoder, no Modbus hardware is needed
+//1. Frames/second of decode() for each function code and frame size
+//2. Random corruption of valid frames: decoder must not write outside its registers
+//   and must not accept a corrupted frame
+
+#include "ModbusXT.h"
+
+#define BENCH_FRAMES  2000    //Frames decoded for each function and size
+#define FUZZ_FRAMES   20000   //Corrupted frames in robustness test
+#define GUARD         0xA5A5  //Value of guard registers around decoded registers
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Decoded registers with guard registers on both sides
+uint16_t regs[BUFFER_SIZE/2 + 2];
+
+uint8_t response[BUFFER_SIZE];
+
+Packet packet;
+
+//Modbus Master class define
+Modbus master;
+
+//CRC16 of Modbus RTU, low byte first on the bus
+uint16_t crc16(const uint8_t* data, uint8_t size)
+{
+  uint16_t temp = 0xFFFF;
+  for (uint8_t i = 0; i < size; i++)
+  {
+    temp ^= data[i];
+    for (uint8_t j = 0; j < 8; j++)
+      temp = (temp & 1) ? (temp >> 1) ^ 0xA001 : temp >> 1;
+  }
+  return temp;
+}
+
+//Build valid response of a packet, return its size
+uint8_t buildResponse(Packet* p)
+{
+  uint8_t size = 0;
+  response[size++] = p->id;
+  response[size++] = p->function;
+
+  switch (p->function)
+  {
+    case READ_COIL_STATUS:
+    case READ_INPUT_STATUS:
+      response[size++] = (p->data + 7) / 8;
+      for (uint8_t i = 0; i < (p->data + 7) / 8; i++)
+        response[size++] = random(256);
+      break;
+    case READ_HOLDING_REGISTERS:
+    case READ_INPUT_REGISTERS:
+      response[size++] = p->data * 2;
+      for (uint8_t i = 0; i < p->data * 2; i++)
+        response[size++] = random(256);
+      break;
+    default:  //echo of function 5, 6, 15 & 16
+      response[size++] = p->address >> 8;
+      response[size++] = p->address & 0xFF;
+      response[size++] = p->data >> 8;
+      response[size++] = p->data & 0xFF;
+  }
+
+  uint16_t crc = crc16(response, size);
+  response[size++] = crc & 0xFF;
+  response[size++] = crc >> 8;
+  return size;
+}
+
+bool guardOk()
+{
+  return regs[0] == GUARD && regs[BUFFER_SIZE/2 + 1] == GUARD;
+}
+
+void bench(uint8_t function, uint16_t data)
+{
+  master.construct(&packet, 1, function, 0, data, 0);
+  uint8_t size = buildResponse(&packet);
+
+  uint16_t accepted = 0;
+  unsigned long start = micros();
+  for (uint16_t i = 0; i < BENCH_FRAMES; i++)
+    accepted += master.decode(&packet, response, size, &regs[1]);
+  unsigned long elapsed = micros() - start;
+
+  print("F");
+  print(function);
+  print("\tsize: ");
+  print(size);
+  print("\taccepted: ");
+  print(accepted);
+  print("\tframes/s: ");
+  println(elapsed ? (BENCH_FRAMES * 1000000UL) / elapsed : 0);
+}
+
+void fuzz()
+{
+  const uint8_t functions[] = {READ_COIL_STATUS, READ_HOLDING_REGISTERS, PRESET_SINGLE_REGISTER, PRESET_MULTIPLE_REGISTERS};
+  uint16_t accepted = 0;
+  uint16_t overwritten = 0;
+
+  for (uint16_t i = 0; i < FUZZ_FRAMES; i++)
+  {
+    uint8_t function = functions[random(4)];
+    master.construct(&packet, 1, function, random(100), random(1, 29), 0);
+    uint8_t size = buildResponse(&packet);
+
+    //Corrupt 1 to 3 bytes in a row, cut or extend frame
+    uint8_t flips = random(1, 4);
+    uint8_t position = random(size);
+    for (uint8_t j = 0; j < flips; j++)
+      response[(position + j) % size] ^= random(1, 256);
+    if (random(4) == 0)
+      size = random(1, BUFFER_SIZE + 1);
+
+    accepted += master.decode(&packet, response, size, &regs[1]);
+    if (!guardOk())
+      overwritten++;
+    regs[0] = GUARD;
+    regs[BUFFER_SIZE/2 + 1] = GUARD;
+  }
+
+  print("Corrupted frames: ");
+  print(FUZZ_FRAMES);
+  print("\taccepted: ");
+  print(accepted);
+  print("\tguard overwritten: ");
+  println(overwritten);
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Decoder Bench");
+
+  regs[0] = GUARD;
+  regs[BUFFER_SIZE/2 + 1] = GUARD;
+  randomSeed(1);
+
+  bench(READ_COIL_STATUS, 8);
+  bench(READ_COIL_STATUS, 128);
+  bench(READ_HOLDING_REGISTERS, 1);
+  bench(READ_HOLDING_REGISTERS, 8);
+  bench(READ_HOLDING_REGISTERS, (BUFFER_SIZE - 5) / 2);
+  bench(PRESET_SINGLE_REGISTER, 0);
+  bench(PRESET_MULTIPLE_REGISTERS, 8);
+
+  fuzz();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,174 @@
+//Read and write more registers than one frame holds, no RS485 hardware is needed
+//A 2000 register event log is read from a simulated slave while two cyclic packets keep
+//running. The master splits it into frames and passes each chunk to logChunk, so the
+//log is never kept in RAM. Share sets how much bus time the transfer takes from cyclic
+//packets. Each run reports throughput in registers per second
+
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#define BAUD    57600
+#define TIMEOUT 100
+#define POLLING 2
+#define RETRIES 10
+#define TxEnablePin 2   //Arduino pin to enable transmission, not used by simulated bus
+
+#define LOG_ID      1       //slave with the event log
+#define LOG_ADDRESS 1000    //first register of event log
+#define LOG_SIZE    2000    //registers of event log
+#define CONFIG_SIZE 500     //registers of block write
+
+#define SIM_REGS    64      //register image of simulated slaves, address wraps around it
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+enum {
+  PACKET1,
+  PACKET2,
+  NO_OF_PACKET  //=2
+};
+
+//Masters register array
+uint16_t regs[8];
+
+//Modbus packet
+Packet packets[NO_OF_PACKET];
+
+//Simulated bus
+SimSlave slaves[2];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+
+//Modbus Master class define
+Modbus master;
+
+//Shares of bus time for the runs
+const uint8_t shares[] = {100, 50, 25};
+#define NO_OF_RUNS 3
+
+uint8_t run = 0;
+
+//Checks chunks of the event log as they arrive
+uint16_t mismatches = 0;
+
+//Value of a slave register, see SIM_REGS
+uint16_t expected(uint16_t address)
+{
+  return sim_regs[address % SIM_REGS];
+}
+
+//Sink of block read, takes one decoded chunk
+void logChunk(ModbusBlock* block, uint16_t address, uint16_t* registers, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (registers[i] != expected(address + i))
+      mismatches++;
+  }
+}
+
+//Source of block write, fills one chunk
+void configChunk(ModbusBlock* block, uint16_t address, uint16_t* registers, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+    registers[i] = address + i;
+}
+
+//Run bus until block is finished
+void wait(ModbusBlock* block)
+{
+  while (block->status == REQUEST_PENDING)
+    master.update();
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Block Transfer");
+
+  for (uint8_t i = 0; i < SIM_REGS; i++)
+    sim_regs[i] = i * 7;
+
+  memset(slaves, 0, sizeof(slaves));
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    slaves[i].id = i + 1;
+    slaves[i].latency_min = 1000;
+    slaves[i].latency_max = 3000;
+  }
+  bus.begin(slaves, 2, sim_regs, SIM_REGS, BAUD);
+
+  master.configure(packets, NO_OF_PACKET, regs);
+  master.construct(&packets[PACKET1], 1, READ_HOLDING_REGISTERS, 0, 4, 0);
+  master.construct(&packets[PACKET2], 2, READ_HOLDING_REGISTERS, 0, 4, 4);
+  master.begin(&bus, BAUD, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+}
+
+void loop()
+{
+  if (run > NO_OF_RUNS)
+    return;
+
+  if (run < NO_OF_RUNS)
+  {
+    ModbusBlock log;
+    memset(&log, 0, sizeof(log));
+    log.id = LOG_ID;
+    log.function = READ_HOLDING_REGISTERS;
+    log.address = LOG_ADDRESS;
+    log.count = LOG_SIZE;
+    log.data = logChunk;
+    log.share = shares[run];
+
+    mismatches = 0;
+    uint16_t cyclic = packets[PACKET2].successful_requests;
+    master.transfer(&log);
+    wait(&log);
+
+    print("Event log read, share ");
+    print(shares[run]);
+    println("%");
+    print("  Registers: ");
+    print(log.done);
+    print("\tMismatches: ");
+    print(mismatches);
+    print("\tTime (ms): ");
+    println(log.finish - log.start);
+    print("  Throughput (registers/s): ");
+    print(master.transfer_rate(&log));
+    print("\tCyclic answers of slave 2: ");
+    println((uint16_t)(packets[PACKET2].successful_requests - cyclic));
+  }
+  else
+  {
+    ModbusBlock config;
+    memset(&config, 0, sizeof(config));
+    config.id = 2;
+    config.function = PRESET_MULTIPLE_REGISTERS;
+    config.address = 0;
+    config.count = CONFIG_SIZE;
+    config.data = configChunk;
+    config.share = 50;
+
+    master.transfer(&config);
+    wait(&config);
+
+    //Last registers written are left in the register image of the simulated slave
+    mismatches = 0;
+    for (uint16_t address = CONFIG_SIZE - SIM_REGS; address < CONFIG_SIZE; address++)
+    {
+      if (sim_regs[address % SIM_REGS] != address)
+        mismatches++;
+    }
+
+    print("Config written: ");
+    print(config.done);
+    print(" registers\tMismatches: ");
+    print(mismatches);
+    print("\tThroughput (registers/s): ");
+    println(master.transfer_rate(&config));
+  }
+
+  run++;
+}
@@ -0,0 +1,167 @@
+//Load test of Modbus master with many simulated slaves, no RS485 hardware is needed
+//Slaves have different response latency and fault rates. Each run reports cycle time,
+//throughput and failed packets for one gap, polling, TIMEOUT and RETRIES setting.
+//Fixed gap runs wait polling time after every response, adaptive gap runs only wait
+//3.5 character times plus the turnaround learned for each slave
+//Needs a board with enough RAM for NO_OF_SLAVES packets, e.g. Arduino Mega or DUE
+
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#define BAUD    57600
+#define TxEnablePin 2   //Arduino pin to enable transmission, not used by simulated bus
+
+#define NO_OF_SLAVES  100
+#define REGS_PER_SLAVE 4
+#define TOTAL_REGS    (NO_OF_SLAVES * REGS_PER_SLAVE)
+#define SIM_REGS      64    //register image of simulated slaves
+
+#define RUN_TIME  20000   //Time of each run in milisecond
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Settings of each run
+typedef struct {
+  uint8_t gap;
+  long polling;     //fixed gap: wait time to next request, adaptive gap: minimum time between requests
+  long timeout;
+  uint8_t retries;
+} Run;
+
+const Run runs[] = {
+  {GAP_FIXED, 30, 100, 10},     //polling of the other examples
+  {GAP_FIXED, 2, 50, 3},
+  {GAP_FIXED, 2, 100, 10},
+  {GAP_FIXED, 2, 500, 10},
+  {GAP_ADAPTIVE, 0, 100, 10},   //full bus speed
+  {GAP_ADAPTIVE, 5, 100, 10},   //bus load capped at 200 requests/s
+};
+#define NO_OF_RUNS 6
+
+#define SLOW_TURNAROUND_ID 14   //first slave which needs a long turnaround
+
+// Masters register array
+uint16_t regs[TOTAL_REGS];
+
+//Modbus packet, one per slave
+Packet packets[NO_OF_SLAVES];
+
+//Learned turnaround guards of adaptive gap, one entry for each slow slave
+Turnaround guards[16];
+
+//Simulated bus
+SimSlave slaves[NO_OF_SLAVES];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+
+//Modbus Master class define
+Modbus master;
+
+uint8_t run = 0;
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Bus Farm");
+
+  for (uint8_t i = 0; i < SIM_REGS; i++)
+    sim_regs[i] = i;
+
+  //65% normal, 5% slow turnaround, 10% slow, 10% CRC errors, 5% truncated frames, 5% silent
+  for (uint16_t i = 0; i < NO_OF_SLAVES; i++)
+  {
+    SimSlave* slave = &slaves[i];
+    memset(slave, 0, sizeof(SimSlave));
+    slave->id = i + 1;
+    slave->latency_min = 1000;
+    slave->latency_max = 5000;
+
+    uint8_t profile = i % 20;
+    if (profile == 13)
+      slave->turnaround = 4000;
+    else if (profile == 14 || profile == 15)
+    {
+      slave->latency_min = 20000;
+      slave->latency_max = 60000;
+    }
+    else if (profile == 16 || profile == 17)
+      slave->crc_error = 20;
+    else if (profile == 18)
+      slave->truncate = 20;
+    else if (profile == 19)
+      slave->silent = 100;
+  }
+
+  bus.begin(slaves, NO_OF_SLAVES, sim_regs, SIM_REGS, BAUD);
+}
+
+void loop()
+{
+  if (run == NO_OF_RUNS)
+    return;
+
+  //Restart all packets for this run
+  memset(packets, 0, sizeof(packets));
+  master.configure(packets, NO_OF_SLAVES, regs);
+  for (uint16_t i = 0; i < NO_OF_SLAVES; i++)
+    master.construct(&packets[i], i + 1, READ_HOLDING_REGISTERS, 0, REGS_PER_SLAVE, i * REGS_PER_SLAVE);
+
+  master.begin(&bus, BAUD, runs[run].timeout, runs[run].polling, runs[run].retries, TxEnablePin);
+  master.gap(runs[run].gap, guards, 16);
+
+  uint16_t start_requests = master.total_requests();
+  uint16_t start_failed = master.total_failed();
+  long sm = millis();
+  while ( (millis() - sm) < RUN_TIME )
+    master.update();
+  long elapsed = millis() - sm;
+
+  uint16_t requests = master.total_requests() - start_requests;
+  uint16_t failed = master.total_failed() - start_failed;
+
+  uint16_t disconnected = 0;
+  uint16_t successful = 0;
+  for (uint16_t i = 0; i < NO_OF_SLAVES; i++)
+  {
+    if (!packets[i].connection)
+      disconnected++;
+    successful += packets[i].successful_requests;
+  }
+
+  print(runs[run].gap == GAP_ADAPTIVE ? "Adaptive gap" : "Fixed gap");
+  print("\tPolling: ");
+  print(runs[run].polling);
+  print("\tTimeout: ");
+  print(runs[run].timeout);
+  print("\tRetries: ");
+  println(runs[run].retries);
+
+  print("  Requests: ");
+  print(requests);
+  print("\tSuccessful: ");
+  print(successful);
+  print("\tFailed: ");
+  println(failed);
+
+  print("  Throughput (packets/s): ");
+  println((successful * 1000UL) / elapsed);
+
+  print("  Transactions/s: ");
+  println((requests * 1000UL) / elapsed);
+
+  //A cycle is one request to every packet
+  print("  Cycle time (ms): ");
+  println(requests ? (elapsed * (unsigned long)NO_OF_SLAVES) / requests : 0);
+
+  print("  Disconnected packets: ");
+  println(disconnected);
+
+  if (runs[run].gap == GAP_ADAPTIVE)
+  {
+    print("  Learned turnaround of slow slave (us): ");
+    println(master.turnaround(SLOW_TURNAROUND_ID));
+  }
+
+  run++;
+}
@@ -0,0 +1,129 @@
+//Merge single register writes into function 16 transactions, no RS485 hardware is needed
+//It needs MODBUS_GROUP set to 1 in ModbusXT.h, a define in this sketch does not reach the library
+//A drive takes SETPOINTS setpoints at following addresses, each written by its own
+//PRESET_SINGLE_REGISTER packet. With coalesce() up to MAX_GROUP of them go in one
+//function 16 frame. Both runs use ModbusVirtualClock, so they see the same bus timing.
+//Each run reports write cycle time, the time to write all setpoints once
+
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#if !MODBUS_GROUP
+#error "enable MODBUS_GROUP in ModbusXT.h"
+#else
+
+#define BAUD    19200
+#define TIMEOUT 100
+#define POLLING 2
+#define RETRIES 10
+#define TxEnablePin 2   //Arduino pin to enable transmission, not used by simulated bus
+
+#define SETPOINTS 16    //packets of single register writes
+#define RUN_TIME  60    //seconds of each run
+#define SIM_REGS  32
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Masters register array
+uint16_t regs[SETPOINTS];
+
+//Modbus packet, one per setpoint
+Packet packets[SETPOINTS];
+
+//Simulated drive in virtual time
+SimSlave slaves[1];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+ModbusVirtualClock sim_clock;
+
+//Modbus Master class define
+Modbus master;
+
+unsigned long cycle_start = 0;  //virtual millis() when first setpoint was written
+unsigned long cycle_sum = 0;    //time between two writes of first setpoint
+unsigned long cycles = 0;
+
+uint8_t run = 0;
+
+//Write cycle ends when first setpoint is written again
+void answered(Packet* packet, bool success)
+{
+  if (!success || packet != &packets[0])
+    return;
+
+  unsigned long now = sim_clock.millis();
+  if (cycle_start)
+  {
+    cycle_sum += now - cycle_start;
+    cycles++;
+  }
+  cycle_start = now;
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Coalesce");
+}
+
+void loop()
+{
+  if (run > 1)
+    return;
+
+  memset(slaves, 0, sizeof(slaves));
+  slaves[0].id = 1;
+  slaves[0].latency_min = 2000;
+  slaves[0].latency_max = 4000;
+  memset(sim_regs, 0, sizeof(sim_regs));
+  sim_clock.begin();
+  bus.clock(&sim_clock);
+  bus.begin(slaves, 1, sim_regs, SIM_REGS, BAUD);
+
+  memset(packets, 0, sizeof(packets));
+  master.configure(packets, SETPOINTS, regs);
+  for (uint8_t i = 0; i < SETPOINTS; i++)
+    master.construct(&packets[i], 1, PRESET_SINGLE_REGISTER, i, 0, i);
+
+  master.clock(&sim_clock);
+  master.callback(answered);
+  master.coalesce(run == 1);
+  master.begin(&bus, BAUD, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+
+  cycle_start = 0;
+  cycle_sum = 0;
+  cycles = 0;
+  uint16_t requests = master.total_requests();
+
+  //New setpoints every second
+  for (unsigned long second = 0; second < RUN_TIME; second++)
+  {
+    for (uint8_t i = 0; i < SETPOINTS; i++)
+      regs[i] = second * 100 + i;
+    while (sim_clock.millis() < (second + 1) * 1000)
+      sim_clock.step(&master, &bus);
+  }
+
+  //Last setpoints are written by now
+  uint8_t mismatches = 0;
+  for (uint8_t i = 0; i < SETPOINTS; i++)
+  {
+    if (sim_regs[i] != regs[i])
+      mismatches++;
+  }
+
+  print(run == 1 ? "Coalesced" : "Single writes");
+  print("\tTransactions: ");
+  print((uint16_t)(master.total_requests() - requests));
+  print("\tWrites of first setpoint: ");
+  println(packets[0].successful_requests);
+  print("  Write cycle (ms): ");
+  print(cycles ? cycle_sum / cycles : 0);
+  print("\tMismatches: ");
+  println(mismatches);
+
+  run++;
+}
+
+#endif
@@ -0,0 +1,184 @@
+//Publish only real changes of polled values, no RS485 hardware is needed
+//A simulated power meter has noisy measurements. The same registers are mapped twice,
+//once without and once with deadbands. notify() is called only for points whose value
+//changed, the report compares how many values would be published, e.g. to MQTT.
+//watch() marks changed registers in a bitmap, next_change() takes them one by one
+
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#define BAUD    57600
+#define TIMEOUT 100
+#define POLLING 10
+#define RETRIES 10
+#define TxEnablePin 2   //Arduino pin to enable transmission, not used by simulated bus
+
+#define TOTAL_REGS  8
+#define SIM_REGS    8
+#define REPORT_TIME 10000   //Time between reports in milisecond
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Registers of power meter
+enum {
+  ENERGY_LO,    //Wh, low word first
+  ENERGY_HI,
+  POWER_HI,     //W, IEEE754 float, high word first
+  POWER_LO,
+  TEMPERATURE,  //degree C * 10
+  STATUS,
+  METER_REGS    //=6
+};
+
+// Masters register array
+uint16_t regs[TOTAL_REGS];
+
+//Bitmap of changed registers
+ChangeWord changed[CHANGE_WORDS(TOTAL_REGS)];
+
+//Modbus packet
+Packet packets[1];
+
+//Simulated power meter
+SimSlave slaves[1];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+
+//Modbus Master class define
+Modbus master;
+
+//Application values of power meter
+typedef struct {
+  uint32_t energy;
+  float power;
+  float temperature;
+  uint16_t status;
+} Meter;
+
+Meter raw;      //every change
+Meter filtered; //changes outside deadband
+
+Point raw_points[] = {
+  modbusPoint<uint32_t, ORDER_CDAB>("energy", ENERGY_LO, raw.energy),
+  modbusPoint<float, ORDER_ABCD>("power", POWER_HI, raw.power),
+  modbusPoint<int16_t, ORDER_ABCD>("temperature", TEMPERATURE, raw.temperature, 0.1),
+  modbusPoint<uint16_t, ORDER_ABCD>("status", STATUS, raw.status),
+};
+
+Point filtered_points[] = {
+  modbusPoint<uint32_t, ORDER_CDAB>("energy", ENERGY_LO, filtered.energy, 1.0, 10),                  //10 Wh
+  modbusPoint<float, ORDER_ABCD>("power", POWER_HI, filtered.power, 1.0, 2, DEADBAND_PERCENT),        //2%
+  modbusPoint<int16_t, ORDER_ABCD>("temperature", TEMPERATURE, filtered.temperature, 0.1, 0.5),     //0.5 degree C
+  modbusPoint<uint16_t, ORDER_ABCD>("status", STATUS, filtered.status),                             //every change
+};
+
+#define NO_OF_POINTS 4
+
+PointMap raw_map, filtered_map;
+
+unsigned long reads = 0;
+unsigned long raw_published = 0;
+unsigned long filtered_published = 0;
+unsigned long registers_changed = 0;
+
+float power = 1000;
+float energy = 0;
+
+//Would publish point, e.g. to MQTT
+void published(const Point* point)
+{
+  if (point >= filtered_points && point < filtered_points + NO_OF_POINTS)
+    filtered_published++;
+  else
+    raw_published++;
+}
+
+//Count reads of meter
+void answered(Packet* packet, bool success)
+{
+  if (success)
+    reads++;
+}
+
+//Noisy measurements of simulated meter
+void measure()
+{
+  power += random(-20, 21) * 0.1;               //slow drift
+  float noisy = power + random(-50, 51) * 0.1;  //noise of about 0.5%
+  energy += power / 3600.0 / 50;                //measured 50 times per second
+
+  uint32_t bits;
+  memcpy(&bits, &noisy, sizeof(bits));
+  sim_regs[POWER_HI] = bits >> 16;
+  sim_regs[POWER_LO] = bits & 0xFFFF;
+
+  uint32_t wh = energy;
+  sim_regs[ENERGY_LO] = wh & 0xFFFF;
+  sim_regs[ENERGY_HI] = wh >> 16;
+
+  sim_regs[TEMPERATURE] = 250 + random(-2, 3);  //25 degree C with 0.2 degree noise
+  if (random(1000) == 0)
+    sim_regs[STATUS] ^= 1;
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Deadband");
+
+  memset(slaves, 0, sizeof(slaves));
+  slaves[0].id = 1;
+  slaves[0].latency_min = 1000;
+  slaves[0].latency_max = 3000;
+  bus.begin(slaves, 1, sim_regs, SIM_REGS, BAUD);
+
+  master.configure(packets, 1, regs);
+  master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, METER_REGS, 0);
+
+  master.map(&raw_map, raw_points, NO_OF_POINTS, 0);
+  master.map(&filtered_map, filtered_points, NO_OF_POINTS, 0);
+  master.notify(published);
+  master.callback(answered);
+  master.watch(changed, TOTAL_REGS);
+
+  master.begin(&bus, BAUD, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+}
+
+long sm, dm, mm;
+
+void loop()
+{
+  master.update();  //polling
+
+  sm = millis();
+  if ( (sm - mm) >= 20 )  //meter measures every 20ms
+  {
+    mm = sm;
+    measure();
+  }
+
+  //Changed registers, e.g. for a register based SCADA link
+  uint16_t index = 0;
+  while (master.next_change(&index))
+    registers_changed++;
+
+  if ( (sm - dm) > REPORT_TIME )
+  {
+    dm = sm;
+    print("Reads: ");
+    print(reads);
+    print("\tChanged registers: ");
+    println(registers_changed);
+    print("  Published without deadband: ");
+    print(raw_published);
+    print("\tWith deadband: ");
+    println(filtered_published);
+    print("  Power: ");
+    print(filtered.power);
+    print(" W\tEnergy: ");
+    print(filtered.energy);
+    print(" Wh\tTemperature: ");
+    println(filtered.temperature);
+  }
+}
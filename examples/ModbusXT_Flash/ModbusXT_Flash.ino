@@ -0,0 +1,75 @@
+//Packet table in flash: packet config is stored with PROGMEM, only packet state stays in SRAM
+//Set MODBUS_STATISTICS to 0 in ModbusXT.h to cut packet state to 1 byte per packet
+
+#include "ModbusXT.h"
+
+#define TIMEOUT 500   //Timeout for a failed packet. Timeout need to larger than polling
+#define POLLING 2     //Wait time to next request
+
+#define BAUD        57600  
+#define RETRIES     10    //How many time to re-request packet frome slave if request is failed
+#define BYTE_FORMAT SERIAL_8E1
+#define TxEnablePin 2   //Arduino pin to enable transmission
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Name for register in regs[]
+enum {
+  button1,
+  button2,
+  button3,
+  number_entry,
+  password_entry,
+  slider,
+  led_grn,
+  led_blue,
+  led_red,
+  TOTAL_REGS //=9
+};
+
+const uint8_t hmiID = 1;  //ID of HMI
+
+//Packet config: ID, Function, Address, Number of register or data, start register in master register array
+const PacketConfig packet_config[] PROGMEM = {
+  {hmiID, READ_HOLDING_REGISTERS, 0, 6, button1},
+  {hmiID, PRESET_MULTIPLE_REGISTERS, 111, 3, led_grn},
+};
+
+#define NO_OF_PACKET (sizeof(packet_config) / sizeof(PacketConfig))
+
+//Packet runtime state
+PacketState packet_state[NO_OF_PACKET];
+
+// Masters register array
+uint16_t regs[TOTAL_REGS];
+
+//Modbus Master class define
+Modbus master;  
+
+void setup()
+{
+  //Config packet table and register
+  master.configure_P(packet_config, packet_state, NO_OF_PACKET, regs);
+
+  //Start Modbus
+  master.begin(&Serial1, BAUD, BYTE_FORMAT, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+
+  Serial.begin(57600);  //debug on serial0
+
+  println("Arduino Modbus Flash");
+
+  pinMode(13, OUTPUT);
+}
+
+void loop()
+{
+  master.update();  //polling
+
+  //If button is press, turn on HMI's LED
+  for (uint8_t i=0;i<3;i++)
+    regs[led_grn + i] = (regs[button1 + i] == 1);
+
+  //If Led green is on (or button 0 = 1) turn on Led on arduino
+  digitalWrite(13, regs[led_grn] ? HIGH : LOW);
+}
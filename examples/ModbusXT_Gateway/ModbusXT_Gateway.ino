@@ -0,0 +1,506 @@
+//Modbus TCP gateway in front of a Modbus RTU bus, with Ethernet shield (W5100/W5500)
+//SCADA clients read holding/input registers over TCP. Reads are answered from the registers
+//of the cyclic scan while they are younger than MAX_AGE. An older range is refreshed by sending
+//its cyclic packet at once, other reads and writes are sent as one-shot packets. Clients which
+//ask for registers of a packet already on its way to the slave share its transaction
+//Set SIMULATED_BUS to 1 to test the gateway without RS485 hardware, with any Modbus TCP client
+//With MODBUS_TRACE set to 1 in ModbusXT.h, input registers of unit TRACE_UNIT are the trace
+//records of the master. Each read takes them out, decode them with extras/trace_decode.py
+//Needs a board with enough RAM and a second serial port, e.g. Arduino Mega or DUE
+
+#include <SPI.h>
+#include <Ethernet.h>
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#define SIMULATED_BUS 1   //1: slaves are simulated, 0: slaves are on Serial1
+
+#define TIMEOUT 500   //Timeout for a failed packet
+#define POLLING 0     //Adaptive gap: minimum time between requests, 0 for full bus speed
+
+#define BAUD        57600
+#define RETRIES     3     //How many time to re-request packet frome slave if request is failed
+#define BYTE_FORMAT SERIAL_8E1
+#define TxEnablePin 2   //Arduino pin to enable transmission
+
+#define MAX_AGE     1000  //Cached registers older than this are read from the slave, in milisecond
+#define MAX_CLIENTS 4     //TCP connections, W5100 has 4 sockets
+#define MAX_PENDING 4     //One-shot packets of client requests which are not in cache
+#define MAX_READ    ((BUFFER_SIZE - 5) / 2)   //Registers of one RTU read
+#define MAX_WRITE   ((BUFFER_SIZE - 9) / 2)   //Registers of one RTU write
+#define MBAP_SIZE   7     //Transaction ID, protocol ID, length, unit ID
+#define TCP_FRAME   (MBAP_SIZE + 6 + MAX_WRITE * 2)
+#define MAX_MBAP_LENGTH 254   //unit ID and PDU of the largest Modbus TCP frame
+
+#define ILLEGAL_FUNCTION      1
+#define ILLEGAL_DATA_VALUE    3
+#define SLAVE_DEVICE_BUSY     6
+#define TARGET_FAILED         0x0B   //Gateway target device failed to respond
+
+#define TRACE_UNIT  247   //Unit ID of the gateway itself, it is not on the RTU bus
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED};
+IPAddress ip(192, 168, 1, 177);
+EthernetServer server(502);
+
+//Cyclic packets, their registers are the cache
+enum {
+  METER1,
+  METER2,
+  DRIVE,
+  NO_OF_PACKET
+};
+
+#define CACHE_REGS  28
+#define TOTAL_REGS  (CACHE_REGS + MAX_PENDING * MAX_READ)   //cache, then registers of one-shot packets
+
+// Masters register array
+uint16_t regs[TOTAL_REGS];
+
+//Modbus packet
+Packet packets[NO_OF_PACKET];
+unsigned long refreshed[NO_OF_PACKET];   //millis() of last successful read of cyclic packet
+
+//One-shot packets, registers of packet i start at CACHE_REGS + i * MAX_READ
+Packet oneshots[MAX_PENDING];
+bool oneshot_busy[MAX_PENDING];
+QueuedPacket queue_slots[MAX_PENDING];
+Turnaround guards[3];   //learned turnaround of each slave
+
+typedef struct {
+  EthernetClient socket;
+  uint8_t frame[TCP_FRAME];
+  uint16_t size;          //bytes of request received
+  uint16_t expected;      //bytes of request in progress, 0 until MBAP header is received
+  uint16_t transaction;   //MBAP transaction ID of request in progress
+  uint16_t address;       //first register asked by request in progress
+  uint16_t total;         //registers asked by request in progress
+  Packet* packet;         //packet which answers request in progress, NULL when client is idle
+} Client;
+
+Client clients[MAX_CLIENTS];
+
+//Gateway information
+unsigned long client_requests = 0;
+unsigned long cache_hits = 0;
+unsigned long collapsed = 0;
+unsigned long transactions = 0;
+
+#if SIMULATED_BUS
+#define SIM_REGS 128
+SimSlave slaves[3];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+#endif
+
+//Modbus Master class define
+Modbus master;
+
+long sm;
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Gateway");
+
+  //Config packets and register
+  master.configure(packets, NO_OF_PACKET, regs);
+
+  //Packet,ID,Function,Address,Number of register or data,start register in master register array
+  master.construct(&packets[METER1], 1, READ_HOLDING_REGISTERS, 0, 10, 0);
+  master.construct(&packets[METER2], 2, READ_HOLDING_REGISTERS, 0, 10, 10);
+  master.construct(&packets[DRIVE], 3, READ_INPUT_REGISTERS, 100, 8, 20);
+
+  master.callback(finished);
+  master.queue(queue_slots, MAX_PENDING);
+
+  //Start Modbus
+#if SIMULATED_BUS
+  for (uint8_t i = 0; i < SIM_REGS; i++)
+    sim_regs[i] = i;
+  memset(slaves, 0, sizeof(slaves));
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    slaves[i].id = i + 1;
+    slaves[i].latency_min = 2000;
+    slaves[i].latency_max = 8000;
+  }
+  bus.begin(slaves, 3, sim_regs, SIM_REGS, BAUD);
+  master.begin(&bus, BAUD, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+#else
+  master.begin(&Serial1, BAUD, BYTE_FORMAT, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+#endif
+  master.gap(GAP_ADAPTIVE, guards, 3);
+
+  Ethernet.begin(mac, ip);
+  server.begin();
+  print("Modbus TCP on ");
+  println(Ethernet.localIP());
+
+  sm = millis();
+}
+
+void loop()
+{
+  master.update();
+
+  //Accept new connections
+  EthernetClient socket = server.accept();
+  if (socket)
+  {
+    uint8_t c = 0;
+    while (c < MAX_CLIENTS && clients[c].socket)
+      c++;
+    if (c < MAX_CLIENTS)
+    {
+      clients[c].socket = socket;
+      clients[c].size = 0;
+      clients[c].expected = 0;
+      clients[c].packet = NULL;
+    }
+    else
+      socket.stop();
+  }
+
+  for (uint8_t c = 0; c < MAX_CLIENTS; c++)
+    serveClient(c);
+
+  //Print gateway information
+  if ( (millis() - sm) > 5000 )
+  {
+    print("Client requests: ");
+    print(client_requests);
+    print("\tCache hits: ");
+    print(cache_hits);
+    print("\tCollapsed: ");
+    print(collapsed);
+    print("\tRTU transactions: ");
+    println(transactions);
+    sm = millis();
+  }
+}
+
+//Read request of a client, one request at a time
+void serveClient(uint8_t c)
+{
+  Client* client = &clients[c];
+  if (!client->socket)
+    return;
+
+  if (!client->socket.connected())
+  {
+    dropClient(c);
+    return;
+  }
+
+  //Answer of previous request is not sent yet
+  if (client->packet)
+    return;
+
+  while (client->socket.available())
+  {
+    uint8_t data = client->socket.read();
+    if (client->size < TCP_FRAME)
+      client->frame[client->size] = data;   //rest of an oversize request is not kept
+    client->size++;
+
+    //Length is known once the MBAP header is complete
+    if (client->size == MBAP_SIZE)
+    {
+      uint16_t length = (client->frame[4] << 8) | client->frame[5];   //unit ID and PDU
+      if (length < 2 || length > MAX_MBAP_LENGTH)
+      {
+        dropClient(c);  //not a Modbus TCP frame
+        return;
+      }
+      client->expected = MBAP_SIZE - 1 + length;
+    }
+
+    if (client->size == client->expected)
+    {
+      client->size = 0;
+      client->expected = 0;
+      client_requests++;
+      request(c);
+      return;
+    }
+  }
+}
+
+//Close connection, its request in progress is not answered
+void dropClient(uint8_t c)
+{
+  clients[c].socket.stop();
+  clients[c].size = 0;
+  clients[c].expected = 0;
+  clients[c].packet = NULL;
+}
+
+//Serve a complete request of a client
+void request(uint8_t c)
+{
+  Client* client = &clients[c];
+  uint8_t* frame = client->frame;
+  uint16_t length = (frame[4] << 8) | frame[5];   //unit ID and PDU
+  uint8_t id = frame[6];
+  uint8_t function = frame[7];
+
+  client->transaction = (frame[0] << 8) | frame[1];
+  client->address = (frame[8] << 8) | frame[9];
+  client->total = (frame[10] << 8) | frame[11];
+
+  //Request is valid Modbus TCP but larger than the gateway can forward
+  if (MBAP_SIZE - 1 + length > TCP_FRAME)
+  {
+    exception(c, id, function, ILLEGAL_DATA_VALUE);
+    return;
+  }
+
+#if MODBUS_TRACE
+  if (id == TRACE_UNIT)
+  {
+    if (function != READ_INPUT_REGISTERS)
+      exception(c, id, function, ILLEGAL_FUNCTION);
+    else if (length != 6 || client->total < TRACE_RECORD / 2)
+      exception(c, id, function, ILLEGAL_DATA_VALUE);
+    else
+      answerTrace(c);
+    return;
+  }
+#endif
+
+  switch (function)
+  {
+    case READ_HOLDING_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    {
+      if (length != 6 || client->total == 0 || client->total > MAX_READ)
+      {
+        exception(c, id, function, ILLEGAL_DATA_VALUE);
+        return;
+      }
+
+      //Registers of cyclic scan, they are refreshed when they are too old
+      for (uint8_t i = 0; i < NO_OF_PACKET; i++)
+      {
+        Packet* packet = &packets[i];
+        if (!covers(packet, id, function, client->address, client->total))
+          continue;
+
+        if (packet->connection && refreshed[i] && (millis() - refreshed[i]) <= MAX_AGE)
+        {
+          cache_hits++;
+          client->packet = packet;
+          answer(c, true);
+          return;
+        }
+
+        waitFor(c, packet);
+        return;
+      }
+
+      //Registers of a one-shot read in progress
+      for (uint8_t i = 0; i < MAX_PENDING; i++)
+      {
+        if (oneshot_busy[i] && covers(&oneshots[i], id, function, client->address, client->total))
+        {
+          waitFor(c, &oneshots[i]);
+          return;
+        }
+      }
+
+      int8_t i = startOneshot(id, function, client->address, client->total);
+      if (i < 0)
+        exception(c, id, function, SLAVE_DEVICE_BUSY);
+      else if (!waitFor(c, &oneshots[i]))
+        oneshot_busy[i] = false;
+      return;
+    }
+    case PRESET_SINGLE_REGISTER:
+    case PRESET_MULTIPLE_REGISTERS:
+    {
+      //Value of function 6 is taken from register array, like the values of function 16
+      const uint8_t* values = &frame[10];
+      if (function == PRESET_MULTIPLE_REGISTERS)
+        values = &frame[13];
+      else
+        client->total = 1;
+
+      if (length < 6 || client->total == 0 || client->total > MAX_WRITE ||
+          (function == PRESET_SINGLE_REGISTER && length != 6) ||
+          (function == PRESET_MULTIPLE_REGISTERS && (length != 7 + client->total * 2 || frame[12] != client->total * 2)))
+      {
+        exception(c, id, function, ILLEGAL_DATA_VALUE);
+        return;
+      }
+
+      int8_t i = startOneshot(id, function, client->address, client->total);
+      if (i < 0)
+      {
+        exception(c, id, function, SLAVE_DEVICE_BUSY);
+        return;
+      }
+      uint16_t* target = &regs[oneshots[i].register_start_address];
+      for (uint16_t j = 0; j < client->total; j++)
+        target[j] = (values[j * 2] << 8) | values[j * 2 + 1];
+      if (!waitFor(c, &oneshots[i]))
+        oneshot_busy[i] = false;
+      return;
+    }
+    default:
+      exception(c, id, function, ILLEGAL_FUNCTION);
+  }
+}
+
+//Registers of a request are read by packet
+bool covers(const Packet* packet, uint8_t id, uint8_t function, uint16_t address, uint16_t total)
+{
+  return packet->id == id && packet->function == function &&
+         address >= packet->address && address + total <= packet->address + packet->data;
+}
+
+//Client waits for a packet. It is sent ahead of cyclic scan, a packet already queued is sent once
+bool waitFor(uint8_t c, Packet* packet)
+{
+  if (!master.send(packet, 1))
+  {
+    exception(c, packet->id, packet->function, SLAVE_DEVICE_BUSY);
+    return false;
+  }
+
+  //Another client waits for the same transaction
+  bool shared = false;
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++)
+    if (clients[i].packet == packet)
+      shared = true;
+  if (shared)
+    collapsed++;
+  else
+    transactions++;
+
+  clients[c].packet = packet;
+  return true;
+}
+
+//Take a free one-shot packet, return its index or -1
+int8_t startOneshot(uint8_t id, uint8_t function, uint16_t address, uint16_t total)
+{
+  for (uint8_t i = 0; i < MAX_PENDING; i++)
+  {
+    if (oneshot_busy[i])
+      continue;
+
+    memset(&oneshots[i], 0, sizeof(Packet));
+    master.construct(&oneshots[i], id, function, address, total, CACHE_REGS + i * MAX_READ);
+    oneshot_busy[i] = true;
+    return i;
+  }
+  return -1;
+}
+
+//Transaction of a packet is finished
+void finished(Packet* packet, bool success)
+{
+  if (packet >= packets && packet < packets + NO_OF_PACKET)
+  {
+    if (success)
+      refreshed[packet - packets] = millis();
+  }
+  else if (packet >= oneshots && packet < oneshots + MAX_PENDING)
+  {
+    oneshot_busy[packet - oneshots] = false;
+
+    //Registers written by a client are not fresh in cache anymore
+    if (success && (packet->function == PRESET_SINGLE_REGISTER || packet->function == PRESET_MULTIPLE_REGISTERS))
+    {
+      uint16_t total = (packet->function == PRESET_SINGLE_REGISTER) ? 1 : packet->data;
+      for (uint8_t i = 0; i < NO_OF_PACKET; i++)
+        if (packets[i].id == packet->id && packets[i].function == READ_HOLDING_REGISTERS &&
+            packet->address < packets[i].address + packets[i].data &&
+            packets[i].address < packet->address + total)
+          refreshed[i] = 0;
+    }
+  }
+
+  for (uint8_t c = 0; c < MAX_CLIENTS; c++)
+    if (clients[c].packet == packet)
+      answer(c, success);
+}
+
+//Answer request in progress of a client from its packet
+void answer(uint8_t c, bool success)
+{
+  Client* client = &clients[c];
+  Packet* packet = client->packet;
+  uint8_t pdu[2 + MAX_READ * 2];
+  uint8_t size;
+
+  pdu[0] = packet->function;
+  if (!success)
+  {
+    pdu[0] |= 0x80;
+    pdu[1] = TARGET_FAILED;
+    size = 2;
+  }
+  else if (packet->function == READ_HOLDING_REGISTERS || packet->function == READ_INPUT_REGISTERS)
+  {
+    const uint16_t* values = &regs[packet->register_start_address + client->address - packet->address];
+    pdu[1] = client->total * 2;
+    for (uint16_t i = 0; i < client->total; i++)
+    {
+      pdu[2 + i * 2] = values[i] >> 8;
+      pdu[3 + i * 2] = values[i] & 0xFF;
+    }
+    size = 2 + client->total * 2;
+  }
+  else  //echo of write request
+  {
+    uint16_t data = packet->data;
+    if (packet->function == PRESET_SINGLE_REGISTER)
+      data = regs[packet->register_start_address];
+    pdu[1] = packet->address >> 8;
+    pdu[2] = packet->address & 0xFF;
+    pdu[3] = data >> 8;
+    pdu[4] = data & 0xFF;
+    size = 5;
+  }
+
+  client->packet = NULL;
+  reply(c, packet->id, pdu, size);
+}
+
+#if MODBUS_TRACE
+//Answer with whole trace records, 4 registers each. Fewer registers are returned when
+//there are not enough records, none when trace is empty
+void answerTrace(uint8_t c)
+{
+  uint8_t pdu[2 + MAX_READ * 2];
+  uint16_t total = clients[c].total;
+  if (total > MAX_READ)
+    total = MAX_READ;
+
+  pdu[0] = READ_INPUT_REGISTERS;
+  pdu[1] = master.trace_read(&pdu[2], total * 2);
+  reply(c, TRACE_UNIT, pdu, 2 + pdu[1]);
+}
+#endif
+
+void exception(uint8_t c, uint8_t id, uint8_t function, uint8_t code)
+{
+  uint8_t pdu[2] = {(uint8_t)(function | 0x80), code};
+  reply(c, id, pdu, 2);
+}
+
+//Write MBAP header and PDU to client
+void reply(uint8_t c, uint8_t id, const uint8_t* pdu, uint8_t size)
+{
+  uint16_t transaction = clients[c].transaction;
+  uint8_t header[MBAP_SIZE] = {
+    (uint8_t)(transaction >> 8), (uint8_t)transaction, 0, 0, 0, (uint8_t)(size + 1), id
+  };
+  clients[c].socket.write(header, MBAP_SIZE);
+  clients[c].socket.write(pdu, size);
+}
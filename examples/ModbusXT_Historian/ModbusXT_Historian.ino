@@ -0,0 +1,140 @@
+//Benchmark of the sample historian of ModbusXT_History.h, no Modbus hardware is needed
+//Two polled reads of a process are recorded on a simulated time line, one sample every
+//POLLING miliseconds, to measure insert throughput, compression ratio and query time
+//Send 'h' on Serial to dump the historian, extras/history_decode.py decodes it
+
+#include "ModbusXT.h"
+#include "ModbusXT_History.h"
+
+#define POLLING       1000  //Time between samples of one read in milisecond
+#define SAMPLES       100   //Samples of each read per run
+#define HISTORY_SIZE  2048  //Bytes of historian ring
+#define QUERY_TIME    60000 //Time range of query, last minute of history in milisecond
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//First read: slow analog values
+enum {
+  LEVEL,        //tank level, follows a slow ramp
+  TEMPERATURE,  //degree C * 10, random walk
+  PRESSURE,     //noisy around a set point
+  FLOW,         //constant while valve is open
+  VALVE,        //0 or 1, rarely changes
+  ALARM,        //bit field, mostly 0
+  READ1_REGS    //=6
+};
+
+//Second read: counters and set points
+enum {
+  COUNTER_LO = READ1_REGS,  //pulse counter, low word first
+  COUNTER_HI,
+  SETPOINT1,
+  SETPOINT2,
+  SETPOINT3,
+  RUN_HOURS,
+  MODE,
+  SPARE1,
+  SPARE2,
+  TOTAL_REGS    //=15
+};
+
+//Registers as a master would poll them
+uint16_t regs[TOTAL_REGS];
+
+//Historian
+uint8_t history_buffer[HISTORY_SIZE];
+uint16_t history_state[2 * TOTAL_REGS];
+ModbusHistory history;
+unsigned long history_time = 0;   //end of simulated time line
+
+//Next values of simulated process
+void simulate(unsigned long time)
+{
+  regs[LEVEL] = 500 + (time / 2000) % 400;
+  regs[TEMPERATURE] += random(3) - 1;
+  regs[PRESSURE] = 1000 + random(-4, 5);
+  regs[FLOW] = regs[VALVE] ? 120 : 0;
+  if (random(200) == 0)
+    regs[VALVE] ^= 1;
+  regs[ALARM] = (random(1000) == 0) ? 4 : 0;
+
+  uint32_t counter = ((uint32_t)regs[COUNTER_HI] << 16) | regs[COUNTER_LO];
+  counter += random(20);
+  regs[COUNTER_LO] = counter & 0xFFFF;
+  regs[COUNTER_HI] = counter >> 16;
+  regs[RUN_HOURS] = time / 3600000UL;
+}
+
+//Count samples of a query
+void counted(unsigned long time, uint16_t register_start, const uint16_t* values, uint8_t count, void* arg)
+{
+  (*(uint16_t*)arg)++;
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+
+  println("Arduino Modbus Historian Bench");
+
+  regs[TEMPERATURE] = 215;
+  regs[SETPOINT1] = 600;
+  regs[SETPOINT2] = 250;
+  regs[SETPOINT3] = 1000;
+  regs[MODE] = 2;
+  randomSeed(1);
+
+  history.begin(history_buffer, sizeof(history_buffer), history_state, TOTAL_REGS);
+}
+
+void loop()
+{
+  //Record samples of both reads and measure insert throughput
+  uint32_t samples = 0;
+  unsigned long elapsed = 0;
+  for (uint16_t i = 0; i < SAMPLES; i++)
+  {
+    history_time += POLLING;
+    simulate(history_time);
+
+    unsigned long start = micros();
+    samples += history.record(history_time, 0, &regs[0], READ1_REGS);
+    samples += history.record(history_time, READ1_REGS, &regs[READ1_REGS], TOTAL_REGS - READ1_REGS);
+    elapsed += micros() - start;
+  }
+
+  print("History samples: ");
+  print(samples);
+  print("\tTime(us): ");
+  print(elapsed);
+  print("\tSamples/s: ");
+  println(elapsed ? (unsigned long)((samples * 1000000ULL) / elapsed) : 0);
+  print("  Raw bytes: ");
+  print(history.raw_bytes());
+  print("\tStored bytes: ");
+  print(history.stored_bytes());
+  print("\tRatio: ");
+  println(history.stored_bytes() ? (float)history.raw_bytes() / history.stored_bytes() : 0);
+  print("  Ring used: ");
+  print(history.used());
+  print("\tSpan(s): ");
+  print(history.span() / 1000);
+  print("\tDropped: ");
+  println(history.dropped());
+
+  uint16_t found = 0;
+  unsigned long start = micros();
+  history.query(history_time - QUERY_TIME, history_time, counted, &found);
+  elapsed = micros() - start;
+  print("  Query of last minute: ");
+  print(found);
+  print(" samples\tTime(us): ");
+  println(elapsed);
+
+  //Dump historian on request
+  if (Serial.available() && Serial.read() == 'h')
+    history.dump(&Serial);
+
+  delay(1000);
+}
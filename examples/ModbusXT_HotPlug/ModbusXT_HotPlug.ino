@@ -0,0 +1,151 @@
+//Add and remove slaves while the bus is running, no RS485 hardware is needed
+//Packet table is kept twice. A changed copy is built in the spare table and handed
+//to reconfigure(), master takes it between two transactions. Packets which are not
+//changed keep their statistics, a new slave is requested within one cycle
+
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#define BAUD    57600
+#define TIMEOUT 100
+#define POLLING 10
+#define RETRIES 3
+#define TxEnablePin 2   //Arduino pin to enable transmission, not used by simulated bus
+
+#define MAX_SLAVES      8
+#define REGS_PER_SLAVE  4
+#define SIM_REGS        64
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Masters register array, each slave has its own registers
+uint16_t regs[MAX_SLAVES * REGS_PER_SLAVE];
+
+//Two packet tables, master runs one while the other is changed
+Packet tables[2][MAX_SLAVES];
+uint8_t active = 0;
+uint8_t total_packets = 0;
+
+//Simulated bus, slave 3 is plugged later
+SimSlave slaves[3];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+
+//Modbus Master class define
+Modbus master;
+
+uint8_t step = 0;
+
+//Hand spare table to master and wait until it is taken
+void publish(uint8_t total)
+{
+  uint8_t spare = active ^ 1;
+  master.reconfigure(tables[spare], total, regs);
+  while (!master.reconfigured())
+    master.update();
+
+  active = spare;
+  total_packets = total;
+}
+
+//Add a read packet for a slave
+void plug(uint8_t id)
+{
+  Packet* spare = tables[active ^ 1];
+  memcpy(spare, tables[active], total_packets * sizeof(Packet));
+  master.construct(&spare[total_packets], id, READ_HOLDING_REGISTERS, 0, REGS_PER_SLAVE, (id - 1) * REGS_PER_SLAVE);
+  publish(total_packets + 1);
+}
+
+//Remove packets of a slave
+void unplug(uint8_t id)
+{
+  Packet* spare = tables[active ^ 1];
+  uint8_t total = 0;
+  for (uint8_t i = 0; i < total_packets; i++)
+  {
+    if (tables[active][i].id != id)
+      spare[total++] = tables[active][i];
+  }
+  publish(total);
+}
+
+//Run bus for a while
+void run(long time)
+{
+  long sm = millis();
+  while ( (millis() - sm) < time )
+    master.update();
+}
+
+void printTable()
+{
+  for (uint8_t i = 0; i < total_packets; i++)
+  {
+    Packet* packet = &tables[active][i];
+    print("  Slave ");
+    print(packet->id);
+    print("\tRequests: ");
+    print(packet->requests);
+    print("\tSuccessful: ");
+    println(packet->successful_requests);
+  }
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Hot Plug");
+
+  for (uint8_t i = 0; i < SIM_REGS; i++)
+    sim_regs[i] = i;
+
+  memset(slaves, 0, sizeof(slaves));
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    slaves[i].id = i + 1;
+    slaves[i].latency_min = 1000;
+    slaves[i].latency_max = 3000;
+  }
+  bus.begin(slaves, 3, sim_regs, SIM_REGS, BAUD);
+
+  //Start with slave 1 and 2
+  master.construct(&tables[0][0], 1, READ_HOLDING_REGISTERS, 0, REGS_PER_SLAVE, 0);
+  master.construct(&tables[0][1], 2, READ_HOLDING_REGISTERS, 0, REGS_PER_SLAVE, REGS_PER_SLAVE);
+  total_packets = 2;
+  master.configure(tables[0], total_packets, regs);
+  master.begin(&bus, BAUD, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+}
+
+void loop()
+{
+  if (step == 0)
+  {
+    run(2000);
+    println("Slave 1 and 2:");
+    printTable();
+
+    //Slave 3 joins, count requests until it is answered
+    uint16_t requests = master.total_requests();
+    plug(3);
+    while (tables[active][2].successful_requests == 0)
+      master.update();
+    print("Slave 3 plugged, answered after requests: ");
+    println((uint16_t)(master.total_requests() - requests));
+
+    run(2000);
+    printTable();
+  }
+  else if (step == 1)
+  {
+    unplug(1);
+    println("Slave 1 unplugged, statistics of slave 2 and 3 are kept:");
+    run(2000);
+    printTable();
+  }
+  else
+    return;
+
+  step++;
+}
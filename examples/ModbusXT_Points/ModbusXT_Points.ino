@@ -0,0 +1,91 @@
+//Decode registers of a power meter straight into an application struct
+//Points are decoded once after each successful read, loop() only uses typed values
+
+#include "ModbusXT.h"
+
+#define TIMEOUT 500   //Timeout for a failed packet. Timeout need to larger than polling
+#define POLLING 2     //Wait time to next request
+
+#define BAUD        9600
+#define RETRIES     10    //How many time to re-request packet frome slave if request is failed
+#define BYTE_FORMAT SERIAL_8E1
+#define TxEnablePin 2   //Arduino pin to enable transmission
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+enum {
+  PACKET1,
+  NO_OF_PACKET  //=1
+};
+
+#define TOTAL_REGS 8
+
+// Masters register array
+uint16_t regs[TOTAL_REGS];
+
+//Modbus packet
+Packet packets[NO_OF_PACKET];
+
+//Application values of power meter
+struct {
+  uint32_t energy;      //Wh, 2 registers, low word first
+  float power;          //W, IEEE754 float, high word first
+  float voltage;        //V, register holds voltage * 10
+  int16_t temperature;  //degree C
+  uint16_t status;
+} meter;
+
+//Points of power meter, offset is relative to regs[0]
+Point meter_points[] = {
+  modbusPoint<uint32_t, ORDER_CDAB>("energy", 0, meter.energy),
+  modbusPoint<float, ORDER_ABCD>("power", 2, meter.power),
+  modbusPoint<uint16_t, ORDER_ABCD>("voltage", 4, meter.voltage, 0.1),
+  modbusPoint<int16_t, ORDER_ABCD>("temperature", 5, meter.temperature),
+  modbusPoint<uint16_t, ORDER_ABCD>("status", 6, meter.status),
+};
+PointMap meter_map;
+
+const uint8_t meterID = 1;  //ID of power meter
+
+//Modbus Master class define
+Modbus master;  
+
+void setup()
+{
+  //Config packets and register
+  master.configure(packets, NO_OF_PACKET, regs);
+
+  master.construct(&packets[PACKET1], meterID, READ_HOLDING_REGISTERS, 0, 7, 0);
+
+  //Decode meter points from regs[0]
+  master.map(&meter_map, meter_points, sizeof(meter_points) / sizeof(Point), 0);
+
+  //Start Modbus
+  master.begin(&Serial1, BAUD, BYTE_FORMAT, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+
+  Serial.begin(57600);  //debug on serial0
+
+  println("Arduino Modbus Points");
+}
+
+long sm, dm;
+
+void loop()
+{
+  master.update();  //polling
+
+  sm = millis();
+  if ( (sm - dm) > 1000 ) //print every 1s
+  {
+    dm = sm;
+    print("Energy: ");
+    print(meter.energy);
+    print("\tPower: ");
+    print(meter.power);
+    print("\tVoltage: ");
+    print(meter.voltage);
+    print("\tTemperature: ");
+    println(meter.temperature);
+  }
+}
@@ -5,10 +5,12 @@
 #include "ModbusXT.h"
 #include <NilSerial.h>
 #include <NilRTOS.h>
+#include "ModbusXT_OS.h"
 
 #define Serial NilSerial
 
 // Declare a semaphore with an inital counter value of zero.
+// It is signaled when a request of Thread3 is finished
 SEMAPHORE_DECL(sem, 0);
 
 #define TIMEOUT 500   //Timeout for a failed packet. Timeout need to larger than polling
@@ -39,6 +41,7 @@ enum {
   led_blue,
   led_red,
   graph,
+  sample,
   TOTAL_REGS,
 };
 
@@ -56,6 +59,14 @@ uint16_t regs[TOTAL_REGS];
 //Modbus packet
 Packet packets[NO_OF_PACKET];
 
+//One-shot packet of Thread3, it is submitted instead of being polled
+Packet sample_packet;
+ModbusRequest sample_request;
+
+//Storage of one-shot and submission queues, submission queue size is a power of 2, at least 2
+QueuedPacket queue_slots[2];
+SubmitSlot submit_slots[2];
+
 // Access individual packet parameter. Uncomment it if you know what you're doing
 // packetPointer packet1 = &packets[PACKET1];
 // packetPointer packet2 = &packets[PACKET2];
@@ -73,48 +84,21 @@ uint16_t num, temp;
 //Modbus class define
 Modbus master;
 
+//Wakes Thread1 when a request is submitted
+ModbusEvent event;
+
 //Modbus communication in this thread
+//It sleeps while master has nothing to do, lower priority threads run meanwhile.
+//Serial1 has no receive hook, so a response is checked once per expected frame time.
+//With a port which has one, call master.received() from it to wake only on frames
 NIL_WORKING_AREA(waThread1, 100);
 // Declare the thread function for thread 1.
 NIL_THREAD(Thread1, arg) {
-  bool ready_flag = 1;
-  bool packet_ok = 0;
-  systime_t prev_time = nilTimeNow();
+  event.begin();
+  master.wake(ModbusEvent::wake, ModbusEvent::wakeFromISR, &event);
   while (1) {
-
-    //Request packet
-    if (ready_flag)
-    {
-      master.request();
-      ready_flag = 0;
-      prev_time = nilTimeNow();
-    }
-
-    //check polling
-    uint8_t finish=(nilTimeNow()-prev_time) > POLLING;
-    if (packet_ok && finish)
-    {
-      ready_flag = 1;
-      packet_ok = 0;
-      prev_time = nilTimeNow();
-    }
-    else if (packet_ok && !finish)
-      nilThdSleep(POLLING - (nilTimeNow() - prev_time - 1));
-
-    //check response
-    if (!packet_ok)
-    {
-      packet_ok = master.response();
-      if ( (nilTimeNow() - prev_time ) > TIMEOUT  ) //check timeout
-      {
-        println("timeout");
-        packet_ok = 1;
-        master.error();
-        prev_time = nilTimeNow();
-      }
-      
-    }  
-
+    master.update();
+    event.wait(master.idle());
   }//end of while
 }//end of thread 1
 
@@ -130,10 +114,37 @@ NIL_THREAD(Thread2, arg) {
     temp = regs[total_requests];
   }
 }
+//Called by Thread1 when request of Thread3 is finished
+void sampleDone(ModbusRequest* request)
+{
+  nilSemSignal(&sem);
+}
+
+//Acquisition thread, it writes a sample to HMI without touching master
+//Threads call submit(), interrupts submitFromISR(), Thread1 is the only one which sends them
+NIL_WORKING_AREA(waThread3, 64);
+NIL_THREAD(Thread3, arg) {
+  sample_request.packet = &sample_packet;
+  sample_request.priority = 1;
+  sample_request.done = sampleDone;
+  while(1)
+  {
+    nilThdSleep(500);
+    regs[sample] = analogRead(A0);
+    if (!master.submit(&sample_request))
+      continue;   //submission queue is full, try with next sample
+
+    nilSemWait(&sem);   //sleep until request is finished
+    if (sample_request.status == REQUEST_FAILED)
+      println("Sample failed");
+  }
+}
+
 //-----------NilRTOS--------------
 NIL_THREADS_TABLE_BEGIN()
 NIL_THREADS_TABLE_ENTRY("thread1", Thread1, NULL, waThread1, sizeof(waThread1))
 NIL_THREADS_TABLE_ENTRY("thread2", Thread2, NULL, waThread2, sizeof(waThread2))
+NIL_THREADS_TABLE_ENTRY("thread3", Thread3, NULL, waThread3, sizeof(waThread3))
 NIL_THREADS_TABLE_END()
 //--------------------------------
 
@@ -147,6 +158,11 @@ void setup()
 
   master.construct(&packets[PACKET2], hmiID, PRESET_MULTIPLE_REGISTERS, 100, 9, 6);
 
+  //Sample is written to HMI address 120 by Thread3
+  master.construct(&sample_packet, hmiID, PRESET_SINGLE_REGISTER, 120, 0, sample);
+  master.queue(queue_slots, 2);
+  master.submit_queue(submit_slots, 2);
+
   //Start Modbus
   master.begin(&Serial1, BAUD, BYTE_FORMAT, TIMEOUT, POLLING, RETRIES, TxEnablePin);
 
@@ -0,0 +1,103 @@
+//Capture real bus traffic and replay it against the frame decoder to measure parser throughput
+//It needs MODBUS_CAPTURE set to 1 in ModbusXT.h, a define in this sketch does not reach the library
+//Send 'd' on Serial to dump the binary trace, e.g. to save it into a file on PC
+//extras/host/replay_capture replays such a file on PC
+
+#include "ModbusXT.h"
+
+#if !MODBUS_CAPTURE
+#error "enable MODBUS_CAPTURE in ModbusXT.h"
+#else
+
+#define TIMEOUT 500   //Timeout for a failed packet. Timeout need to larger than polling
+#define POLLING 2     //Wait time to next request
+
+#define BAUD        57600  
+#define RETRIES     10    //How many time to re-request packet frome slave if request is failed
+#define BYTE_FORMAT SERIAL_8E1
+#define TxEnablePin 2   //Arduino pin to enable transmission
+
+#define CAPTURE_TIME  5000  //Time to capture bus traffic in milisecond
+#define REPLAY_LOOPS  100   //How many times the trace is replayed
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+enum {
+  PACKET1,
+  PACKET2,
+  NO_OF_PACKET  //=2
+};
+
+#define TOTAL_REGS 15
+
+// Masters register array
+uint16_t regs[TOTAL_REGS];
+
+// Registers used by replay, need to hold the largest response
+uint16_t replay_regs[BUFFER_SIZE/2];
+
+//Modbus packet
+Packet packets[NO_OF_PACKET];
+
+//Linear copy of capture buffer
+uint8_t trace[CAPTURE_SIZE];
+uint16_t trace_size = 0;
+
+const uint8_t hmiID = 1;  //ID of HMI
+
+//Modbus Master class define
+Modbus master;  
+
+void setup()
+{
+  //Config packets and register
+  master.configure(packets, NO_OF_PACKET, regs);
+
+  master.construct(&packets[PACKET1], hmiID, READ_HOLDING_REGISTERS, 0, 6, 0);
+
+  master.construct(&packets[PACKET2], hmiID, PRESET_MULTIPLE_REGISTERS, 100, 9, 6);
+
+  //Start Modbus
+  master.begin(&Serial1, BAUD, BYTE_FORMAT, TIMEOUT, POLLING, RETRIES, TxEnablePin);
+
+  Serial.begin(57600);  //debug on serial0
+
+  println("Arduino Modbus Replay");
+
+  //Record live traffic
+  master.capture(true);
+  long sm = millis();
+  while ( (millis() - sm) < CAPTURE_TIME )
+    master.update();
+  master.capture(false);
+
+  trace_size = master.capture_read(trace, sizeof(trace));
+  print("Trace bytes: ");
+  println(trace_size);
+}
+
+void loop()
+{
+  //Replay trace and measure decoder throughput
+  uint32_t frames = 0;
+  unsigned long start = micros();
+  for (uint16_t i = 0; i < REPLAY_LOOPS; i++)
+    frames += master.replay(trace, trace_size, replay_regs);
+  unsigned long elapsed = micros() - start;
+
+  print("Frames: ");
+  print(frames);
+  print("\tTime(us): ");
+  print(elapsed);
+  print("\tFrames/s: ");
+  println(elapsed ? (frames * 1000000UL) / elapsed : 0);
+
+  //Dump binary trace on request
+  if (Serial.available() && Serial.read() == 'd')
+    master.capture_dump(&Serial);
+
+  delay(1000);
+}
+
+#endif
@@ -0,0 +1,306 @@
+//Run the master against simulated slaves in virtual time, no RS485 hardware is needed
+//Timeouts, gaps and retries run on ModbusVirtualClock, so hours of bus traffic take
+//seconds of CPU and a run with the same seed always gives the same result.
+//First run watches one bus for LONG_RUN hours, then SWEEP_RUNS random bus configurations
+//run for SWEEP_TIME each. Runs report cycle time, starved packets and retry storms
+//Needs a board with enough RAM for MAX_SLAVES packets, e.g. Arduino DUE, or a PC build
+
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+
+#define BAUD    57600
+#define TxEnablePin 2   //Arduino pin to enable transmission, not used by simulated bus
+
+#define MAX_SLAVES      32
+#define REGS_PER_SLAVE  4
+#define SIM_REGS        64
+
+#define LONG_RUN    4       //hours of first run
+#define SWEEP_RUNS  1000    //random bus configurations
+#define SWEEP_TIME  60      //seconds of each sweep run
+
+#define STARVED_TIME  5000  //packet is starved when it is not answered for this time, in milisecond
+#define STORM_SHARE   50    //second is a retry storm when more than this percent of transactions fail
+
+#define print(x)  Serial.print(x)
+#define println(x) Serial.println(x)
+
+//Masters register array
+uint16_t regs[MAX_SLAVES * REGS_PER_SLAVE];
+
+//Modbus packet, one per slave
+Packet packets[MAX_SLAVES];
+
+//Learned turnaround guards of adaptive gap, one entry for each slow slave
+Turnaround guards[16];
+
+//Simulated bus in virtual time
+SimSlave slaves[MAX_SLAVES];
+uint16_t sim_regs[SIM_REGS];
+ModbusSimBus bus;
+ModbusVirtualClock sim_clock;
+
+//Modbus Master class define
+Modbus master;
+
+//Settings of a run
+typedef struct {
+  uint16_t slaves;
+  uint8_t gap;
+  long polling;
+  long timeout;
+  uint8_t retries;
+} Run;
+
+//Result of a run
+typedef struct {
+  unsigned long transactions;
+  unsigned long failed;
+  unsigned long cycle_sum;    //time between two answers of a packet, in milisecond
+  unsigned long cycles;
+  unsigned long cycle_max;
+  uint16_t starved;           //answered packets which waited longer than STARVED_TIME
+  uint16_t silent;            //packets never answered, e.g. of a dead slave
+  uint16_t storms;            //retry storms
+  uint16_t storm_max;         //longest retry storm in seconds
+} Report;
+
+Run settings;
+Report report;
+unsigned long answered_time[MAX_SLAVES];  //virtual millis() of last answer of each packet
+unsigned long cycle_max[MAX_SLAVES];
+bool alive[MAX_SLAVES];   //packet is answered in this run
+
+bool done = false;
+
+//Measure cycle time of each packet
+void answered(Packet* packet, bool success)
+{
+  if (!success)
+    return;
+
+  uint8_t index = packet->id - 1;
+  unsigned long now = sim_clock.millis();
+  unsigned long cycle = now - answered_time[index];
+  if (cycle > cycle_max[index])
+    cycle_max[index] = cycle;
+  answered_time[index] = now;
+  alive[index] = true;
+
+  report.cycle_sum += cycle;
+  report.cycles++;
+}
+
+//Random bus of a run, same run number gives the same bus
+void setupBus(uint16_t run)
+{
+  randomSeed(run + 1);
+
+  settings.slaves = random(2, MAX_SLAVES + 1);
+  settings.gap = random(2) ? GAP_ADAPTIVE : GAP_FIXED;
+  settings.polling = settings.gap == GAP_ADAPTIVE ? random(0, 5) : random(2, 30);
+  settings.timeout = random(50, 500);
+  settings.retries = random(1, 11);
+
+  //75% normal, 5% dead, 10% CRC errors, 5% truncated frames, 5% slow turnaround
+  for (uint16_t i = 0; i < settings.slaves; i++)
+  {
+    SimSlave* slave = &slaves[i];
+    memset(slave, 0, sizeof(SimSlave));
+    slave->id = i + 1;
+    slave->latency_min = random(500, 3000);
+    slave->latency_max = slave->latency_min + random(0, 20000);
+
+    uint8_t profile = random(100);
+    if (profile < 5)
+      slave->silent = 100;
+    else if (profile < 15)
+      slave->crc_error = random(5, 30);
+    else if (profile < 20)
+      slave->truncate = random(5, 30);
+    else if (profile < 25)
+      slave->turnaround = random(1000, 8000);
+  }
+  sim_clock.begin();
+  bus.clock(&sim_clock);
+  bus.begin(slaves, settings.slaves, sim_regs, SIM_REGS, BAUD);
+
+  memset(packets, 0, sizeof(packets));
+  master.configure(packets, settings.slaves, regs);
+  for (uint16_t i = 0; i < settings.slaves; i++)
+    master.construct(&packets[i], i + 1, READ_HOLDING_REGISTERS, 0, REGS_PER_SLAVE, i * REGS_PER_SLAVE);
+
+  master.clock(&sim_clock);
+  master.callback(answered);
+  master.begin(&bus, BAUD, settings.timeout, settings.polling, settings.retries, TxEnablePin);
+  master.gap(settings.gap, guards, 16);
+}
+
+//Run bus for a number of virtual seconds
+void simulate(unsigned long seconds)
+{
+  memset(&report, 0, sizeof(report));
+  memset(cycle_max, 0, sizeof(cycle_max));
+  memset(alive, 0, sizeof(alive));
+
+  unsigned long start = sim_clock.millis();
+  for (uint16_t i = 0; i < settings.slaves; i++)
+    answered_time[i] = start;
+
+  uint16_t requests = master.total_requests();
+  uint16_t failed = master.total_failed();
+  uint16_t storm = 0;
+
+  for (unsigned long second = 1; second <= seconds; second++)
+  {
+    while ( (sim_clock.millis() - start) < second * 1000 )
+      sim_clock.step(&master, &bus);
+
+    //Transactions of this second
+    uint16_t r = master.total_requests() - requests;
+    uint16_t f = master.total_failed() - failed;
+    requests += r;
+    failed += f;
+    report.transactions += r;
+    report.failed += f;
+
+    if (r && f * 100UL > r * (unsigned long)STORM_SHARE)
+    {
+      if (storm++ == 0)
+        report.storms++;
+      if (storm > report.storm_max)
+        report.storm_max = storm;
+    }
+    else
+      storm = 0;
+  }
+
+  //Packet which is still waiting for an answer counts too
+  unsigned long now = sim_clock.millis();
+  for (uint16_t i = 0; i < settings.slaves; i++)
+  {
+    if (!alive[i])
+    {
+      report.silent++;
+      continue;
+    }
+
+    unsigned long cycle = now - answered_time[i];
+    if (cycle_max[i] > cycle)
+      cycle = cycle_max[i];
+    if (cycle > report.cycle_max)
+      report.cycle_max = cycle;
+    if (cycle > STARVED_TIME)
+      report.starved++;
+  }
+}
+
+void printSettings(uint16_t run)
+{
+  print("Run ");
+  print(run);
+  print(": ");
+  print(settings.slaves);
+  print(" slaves\t");
+  print(settings.gap == GAP_ADAPTIVE ? "Adaptive gap" : "Fixed gap");
+  print("\tPolling: ");
+  print(settings.polling);
+  print("\tTimeout: ");
+  print(settings.timeout);
+  print("\tRetries: ");
+  println(settings.retries);
+}
+
+void printReport()
+{
+  print("  Transactions: ");
+  print(report.transactions);
+  print("\tFailed: ");
+  println(report.failed);
+
+  print("  Cycle time (ms): ");
+  print(report.cycles ? report.cycle_sum / report.cycles : 0);
+  print("\tMax: ");
+  println(report.cycle_max);
+
+  print("  Starved packets: ");
+  print(report.starved);
+  print("\tNever answered: ");
+  print(report.silent);
+  print("\tRetry storms: ");
+  print(report.storms);
+  print("\tLongest (s): ");
+  println(report.storm_max);
+}
+
+void setup()
+{
+  Serial.begin(57600);  //debug on serial0
+  println("Arduino Modbus Virtual Time");
+
+  for (uint8_t i = 0; i < SIM_REGS; i++)
+    sim_regs[i] = i;
+}
+
+void loop()
+{
+  if (done)
+    return;
+
+  //One bus for hours, each hour is reported
+  long sm = millis();
+  setupBus(0);
+  printSettings(0);
+  for (uint8_t hour = 1; hour <= LONG_RUN; hour++)
+  {
+    simulate(3600);
+    print("Hour ");
+    println(hour);
+    printReport();
+  }
+  print("Real time (ms): ");
+  println(millis() - sm);
+
+  //Many buses, worst ones are reported
+  sm = millis();
+  uint16_t starved_runs = 0;
+  uint16_t storm_runs = 0;
+  uint16_t worst_run = 0;
+  unsigned long worst_cycle = 0;
+  for (uint16_t run = 1; run <= SWEEP_RUNS; run++)
+  {
+    setupBus(run);
+    simulate(SWEEP_TIME);
+
+    if (report.starved)
+      starved_runs++;
+    if (report.storms)
+      storm_runs++;
+    if (report.cycle_max > worst_cycle)
+    {
+      worst_cycle = report.cycle_max;
+      worst_run = run;
+    }
+  }
+
+  print("Sweep of ");
+  print(SWEEP_RUNS);
+  print(" buses, ");
+  print(SWEEP_TIME);
+  println(" s each");
+  print("  Runs with starved packets: ");
+  print(starved_runs);
+  print("\tRuns with retry storms: ");
+  println(storm_runs);
+  print("Real time (ms): ");
+  println(millis() - sm);
+
+  //Worst run again, it is repeated exactly
+  println("Longest cycle:");
+  setupBus(worst_run);
+  printSettings(worst_run);
+  simulate(SWEEP_TIME);
+  printReport();
+
+  done = true;
+}
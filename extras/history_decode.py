@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Decode ModbusXT historian blocks, see ModbusXT_History.h
+
+Each block starts with used bytes (2), samples (2) and time of first sample (4),
+numbers low byte first. A sample is varint time delta, varint first register,
+one byte count and a zig-zag varint delta per value. First sample of a register
+in a block is stored against 0.
+
+Usage:
+    history_decode.py dump.bin          binary blocks, e.g. from history.dump(&Serial)
+    history_decode.py --hex dump.txt    hex bytes, whitespace is ignored
+    history_decode.py --csv dump.bin    one line per register: time,register,value
+Without a file, blocks are read from stdin.
+"""
+
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct("<HHI")
+
+
+def varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, offset
+
+
+def samples(data):
+    offset = 0
+    while offset + HEADER.size <= len(data):
+        used, count, time = HEADER.unpack_from(data, offset)
+        if used < HEADER.size or offset + used > len(data):
+            print("warning: broken block at byte %d" % offset, file=sys.stderr)
+            return
+        end = offset + used
+        position = offset + HEADER.size
+        values = {}
+        for _ in range(count):
+            delta, position = varint(data, position)
+            time = (time + delta) & 0xFFFFFFFF
+            register, position = varint(data, position)
+            number = data[position]
+            position += 1
+            sample = []
+            for index in range(register, register + number):
+                zigzag, position = varint(data, position)
+                value = (values.get(index, 0) + ((zigzag >> 1) ^ -(zigzag & 1))) & 0xFFFF
+                values[index] = value
+                sample.append(value)
+            yield time, register, sample
+        if position != end:
+            print("warning: %d bytes left in block at byte %d" % (end - position, offset), file=sys.stderr)
+        offset = end
+
+
+def read_bytes(args):
+    if args.hex:
+        text = open(args.file).read() if args.file else sys.stdin.read()
+        return bytes.fromhex("".join(text.split()))
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            return f.read()
+    return sys.stdin.buffer.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode ModbusXT historian blocks")
+    parser.add_argument("file", nargs="?", help="file with blocks, stdin if omitted")
+    parser.add_argument("--hex", action="store_true", help="blocks are hex text")
+    parser.add_argument("--csv", action="store_true", help="one line per register")
+    args = parser.parse_args()
+
+    for time, register, values in samples(read_bytes(args)):
+        if args.csv:
+            for index, value in enumerate(values):
+                print("%d,%d,%d" % (time, register + index, value))
+        else:
+            print("%10d ms  reg %5d  %s" % (time, register, " ".join("%d" % v for v in values)))
+
+
+if __name__ == "__main__":
+    main()
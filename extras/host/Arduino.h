@@ -0,0 +1,94 @@
+// Host stub of the Arduino core, enough to build ModbusXT and its examples on a PC
+// Time is virtual by default: stub_us only moves when a test or delay moves it.
+// STUB_AUTOTICK: every micros()/millis() call moves time by 2 us
+// STUB_REALTIME: time is the monotonic clock of the PC
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define SERIAL_8N1 0x06
+#define SERIAL_8E1 0x26
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define F(x) x
+#define HEX 16
+#define DEC 10
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+extern unsigned long stub_us;   //virtual time in microsecond, defined by each test
+
+#ifdef STUB_REALTIME
+#include <time.h>
+inline unsigned long micros() { timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return t.tv_sec * 1000000UL + t.tv_nsec / 1000; }
+inline unsigned long millis() { return micros() / 1000; }
+inline void delayMicroseconds(unsigned int us) { unsigned long s = micros(); while (micros() - s < us); }
+inline void delay(unsigned long ms) { delayMicroseconds(ms * 1000); }
+#else
+#ifdef STUB_AUTOTICK
+inline unsigned long micros() { return stub_us += 2; }
+inline unsigned long millis() { return (stub_us += 2) / 1000; }
+#else
+inline unsigned long micros() { return stub_us; }
+inline unsigned long millis() { return stub_us / 1000; }
+#endif
+inline void delayMicroseconds(unsigned int us) { stub_us += us; }
+inline void delay(unsigned long ms) { stub_us += ms * 1000; }
+#endif
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howbig > howsmall ? howsmall + random(howbig - howsmall) : howsmall; }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+class Print {
+public:
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) { size_t n = 0; while (size--) n += write(*buffer++); return n; }
+    size_t print(const char* s) { return printf("%s", s); }
+    size_t print(char c) { return printf("%c", c); }
+    size_t print(int v, int base = DEC) { return printf(base == HEX ? "%X" : "%d", v); }
+    size_t print(unsigned v, int base = DEC) { return printf(base == HEX ? "%X" : "%u", v); }
+    size_t print(long v, int base = DEC) { return printf(base == HEX ? "%lX" : "%ld", v); }
+    size_t print(unsigned long v, int base = DEC) { return printf(base == HEX ? "%lX" : "%lu", v); }
+    size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+    template<class T> size_t println(T v) { size_t n = print(v); return n + printf("\n"); }
+    template<class T> size_t println(T v, int format) { size_t n = print(v, format); return n + printf("\n"); }
+    size_t println() { return printf("\n"); }
+    virtual ~Print() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+class HardwareSerial : public Stream {
+public:
+    void begin(long, uint8_t = 0) {}
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t c) { putchar(c); return 1; }
+    using Print::write;
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial, Serial1;
+
+#endif
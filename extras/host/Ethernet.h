@@ -0,0 +1,36 @@
+// host stub of Arduino Ethernet library on POSIX sockets, localhost only
+#include <Arduino.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+struct IPAddress { IPAddress(int,int,int,int){} };
+struct EthernetClass { void begin(byte*, IPAddress){} const char* localIP(){ return "127.0.0.1"; } };
+static EthernetClass Ethernet;
+class EthernetClient : public Stream {
+public:
+  int fd = -1; int pk = -1; bool closed = false;
+  EthernetClient() {}
+  explicit EthernetClient(int f) : fd(f) {}
+  operator bool() { return fd >= 0; }
+  bool connected() { fill(); return fd >= 0 && (!closed || pk >= 0); }
+  void fill() { if (fd < 0 || pk >= 0 || closed) return; uint8_t b; ssize_t n = recv(fd, &b, 1, MSG_DONTWAIT); if (n == 1) pk = b; else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) closed = true; }
+  int available() { fill(); if (pk < 0) return 0; int n = 0; ioctl_avail(n); return 1 + n; }
+  void ioctl_avail(int& n) { uint8_t tmp[512]; ssize_t r = recv(fd, tmp, sizeof tmp, MSG_DONTWAIT | MSG_PEEK); n = r > 0 ? r : 0; }
+  int read() { fill(); int r = pk; pk = -1; return r; }
+  int peek() { fill(); return pk; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) { if (fd < 0) return 0; return send(fd, b, n, MSG_NOSIGNAL) > 0 ? n : 0; }
+  void stop() { if (fd >= 0) close(fd); fd = -1; pk = -1; closed = false; }
+};
+class EthernetServer {
+  int port, lfd = -1;
+public:
+  EthernetServer(int p) : port(p) { const char* e = getenv("GW_PORT"); if (e) port = atoi(e); }
+  void begin() { lfd = socket(AF_INET, SOCK_STREAM, 0); int one = 1; setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    sockaddr_in a = {}; a.sin_family = AF_INET; a.sin_port = htons(port); a.sin_addr.s_addr = htonl(0x7f000001);
+    if (bind(lfd, (sockaddr*)&a, sizeof a) || listen(lfd, 8)) { perror("bind"); exit(1); } fcntl(lfd, F_SETFL, O_NONBLOCK); }
+  EthernetClient accept() { int f = ::accept(lfd, 0, 0); if (f >= 0) { int one = 1; setsockopt(f, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one); } return EthernetClient(f); }
+};
@@ -0,0 +1,177 @@
+// Host test slave: a serial port which answers each request of the master in virtual time.
+// Every request frame is kept in log. A test moves time with stub_us and calls update().
+#ifndef FAKE_SLAVE_H
+#define FAKE_SLAVE_H
+
+#include "ModbusXT.h"
+#include <vector>
+#include <stdio.h>
+#include <assert.h>
+
+unsigned long stub_us = 0;
+HardwareSerial Serial, Serial1;
+
+//CRC16 of a frame in transmission order, 0 when frame with its CRC is valid
+static uint16_t crc16(const uint8_t* frame, int size)
+{
+    uint16_t temp = 0xFFFF;
+    for (int i = 0; i < size; i++)
+    {
+        temp ^= frame[i];
+        for (int j = 0; j < 8; j++)
+            temp = (temp & 1) ? (temp >> 1) ^ 0xA001 : temp >> 1;
+    }
+    return temp;
+}
+
+struct FakeSlave : public HardwareSerial {
+    std::vector<uint8_t> tx, rx;
+    std::vector< std::vector<uint8_t> > log;    //request frames in order
+    size_t rxpos = 0;
+    unsigned long ready_at = 0;     //response is available from this time
+
+    uint16_t hold[256];     //holding and input registers, address modulo 256
+    uint8_t coils[256];
+    int latency_us = 1000;
+    bool silent = false;    //no response
+    bool corrupt = false;   //response with a bad CRC
+
+    FakeSlave()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            hold[i] = i * 10;
+            coils[i] = 0;
+        }
+    }
+
+    size_t write(uint8_t c) { tx.push_back(c); return 1; }
+    using Print::write;
+
+    //Master flushes after the last byte of a request
+    void flush()
+    {
+        log.push_back(tx);
+        respond();
+        tx.clear();
+    }
+
+    //Waiting for a response moves time, so a polling master reaches ready_at
+    int available()
+    {
+        if (stub_us < ready_at)
+        {
+            stub_us += 10;
+            return 0;
+        }
+        return rx.size() - rxpos;
+    }
+
+    int read() { return rxpos < rx.size() ? rx[rxpos++] : -1; }
+    int peek() { return rxpos < rx.size() ? rx[rxpos] : -1; }
+
+    void put16(uint16_t value)
+    {
+        rx.push_back(value >> 8);
+        rx.push_back(value & 0xFF);
+    }
+
+    void respond()
+    {
+        rx.clear();
+        rxpos = 0;
+        if (silent)
+            return;
+
+        uint8_t id = tx[0], function = tx[1];
+        uint16_t address = (tx[2] << 8) | tx[3];
+        uint16_t data = (tx[4] << 8) | tx[5];
+        rx.push_back(id);
+        rx.push_back(function);
+
+        switch (function)
+        {
+            case READ_COIL_STATUS:
+            case READ_INPUT_STATUS:
+            {
+                int bytes = (data + 7) / 8;
+                rx.push_back(bytes);
+                for (int i = 0; i < bytes; i++)
+                {
+                    uint8_t bits = 0;
+                    for (int k = 0; k < 8; k++)
+                        if (i * 8 + k < data && coils[(address + i * 8 + k) & 255])
+                            bits |= 1 << k;
+                    rx.push_back(bits);
+                }
+                break;
+            }
+            case READ_HOLDING_REGISTERS:
+            case READ_INPUT_REGISTERS:
+                rx.push_back(data * 2);
+                for (int i = 0; i < data; i++)
+                    put16(hold[(address + i) & 255]);
+                break;
+            case FORCE_SINGLE_COIL:
+                coils[address & 255] = (data == 0xFF00);
+                put16(address);
+                put16(data);
+                break;
+            case PRESET_SINGLE_REGISTER:
+                hold[address & 255] = data;
+                put16(address);
+                put16(data);
+                break;
+            case FORCE_MULTIPLE_COILS:
+                for (int i = 0; i < data; i++)
+                    coils[(address + i) & 255] = (tx[7 + i / 8] >> (i % 8)) & 1;
+                put16(address);
+                put16(data);
+                break;
+            case PRESET_MULTIPLE_REGISTERS:
+                for (int i = 0; i < data; i++)
+                    hold[(address + i) & 255] = (tx[7 + 2 * i] << 8) | tx[8 + 2 * i];
+                put16(address);
+                put16(data);
+                break;
+            case MASK_WRITE_REGISTER:
+            {
+                uint16_t or_mask = (tx[6] << 8) | tx[7];
+                hold[address & 255] = (hold[address & 255] & data) | (or_mask & ~data);
+                for (int i = 2; i < 8; i++)
+                    rx.push_back(tx[i]);
+                break;
+            }
+            case READ_WRITE_MULTIPLE_REGISTERS:
+            {
+                uint16_t write_address = (tx[6] << 8) | tx[7];
+                uint16_t write_count = (tx[8] << 8) | tx[9];
+                for (int i = 0; i < write_count; i++)
+                    hold[(write_address + i) & 255] = (tx[11 + 2 * i] << 8) | tx[12 + 2 * i];
+                rx.push_back(data * 2);
+                for (int i = 0; i < data; i++)
+                    put16(hold[(address + i) & 255]);
+                break;
+            }
+        }
+
+        uint16_t crc = crc16(rx.data(), rx.size());
+        rx.push_back(crc & 0xFF);
+        rx.push_back(crc >> 8);
+        if (corrupt)
+            rx[2] ^= 1;
+        ready_at = stub_us + latency_us;
+    }
+};
+
+//Run master for a number of updates, each moves time by step
+inline void run(Modbus& master, int updates, unsigned long step = 100)
+{
+    for (int i = 0; i < updates; i++)
+    {
+        master.update();
+        stub_us += step;
+    }
+}
+
+#endif
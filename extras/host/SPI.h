@@ -0,0 +1 @@
+// host stub of Arduino SPI library, the Ethernet stub does not use it
@@ -0,0 +1,73 @@
+// Benchmark of the response decoder: nanoseconds per frame of Modbus::decode()
+// for each function code and frame size. Run by extras/host/run_bench.sh
+#include "FakeSlave.h"
+#include <chrono>
+
+#define BENCH_FRAMES 1000000
+
+static Modbus master;
+static uint16_t regs[BUFFER_SIZE];
+static uint8_t response[BUFFER_SIZE];
+
+//Valid response of a packet, return its size
+static uint8_t buildResponse(const Packet* packet)
+{
+    uint8_t size = 0;
+    response[size++] = packet->id;
+    response[size++] = packet->function;
+
+    switch (packet->function)
+    {
+        case READ_COIL_STATUS:
+        case READ_INPUT_STATUS:
+            response[size++] = (packet->data + 7) / 8;
+            for (int i = 0; i < (packet->data + 7) / 8; i++)
+                response[size++] = rand();
+            break;
+        case READ_HOLDING_REGISTERS:
+        case READ_INPUT_REGISTERS:
+            response[size++] = packet->data * 2;
+            for (int i = 0; i < packet->data * 2; i++)
+                response[size++] = rand();
+            break;
+        default:    //echo of function 5, 6, 15 & 16
+            response[size++] = packet->address >> 8;
+            response[size++] = packet->address & 0xFF;
+            response[size++] = packet->data >> 8;
+            response[size++] = packet->data & 0xFF;
+    }
+
+    uint16_t crc = crc16(response, size);
+    response[size++] = crc & 0xFF;
+    response[size++] = crc >> 8;
+    return size;
+}
+
+static void bench(uint8_t function, uint16_t data)
+{
+    Packet packet;
+    master.construct(&packet, 1, function, 0, data, 0);
+    uint8_t size = buildResponse(&packet);
+
+    long accepted = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i = 0; i < BENCH_FRAMES; i++)
+        accepted += master.decode(&packet, response, size, regs);
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+    assert(accepted == BENCH_FRAMES);
+    printf("F%-2d size %2d: %6.1f ns/frame\n", function, size, (double)elapsed.count() / BENCH_FRAMES);
+}
+
+int main()
+{
+    srand(1);
+    bench(READ_COIL_STATUS, 8);
+    bench(READ_COIL_STATUS, 128);
+    bench(READ_HOLDING_REGISTERS, 1);
+    bench(READ_HOLDING_REGISTERS, 8);
+    bench(READ_HOLDING_REGISTERS, (BUFFER_SIZE - 5) / 2);
+    bench(PRESET_SINGLE_REGISTER, 0);
+    bench(PRESET_MULTIPLE_REGISTERS, 8);
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Fuzz entry point of the response decoder: any input is decoded by Modbus::decode()
+// and registers outside the packet are checked untouched.
+// With libFuzzer: extras/host/run_fuzz.sh, built with -DMODBUS_LIBFUZZER.
+// Without it, main() decodes given input files, or random inputs when there is none.
+//
+// Input: function index, data, flags, then response frame.
+// Flag bit 0 sets slave ID and CRC of the frame, bit 1 its function and the byte count
+// of a read,
+// so the fuzzer gets past these checks.
+#include "FakeSlave.h"
+
+#define GUARD_WORDS 64
+#define GUARD 0xA5A5
+
+static Modbus master;
+static uint16_t regs[GUARD_WORDS + 256 + GUARD_WORDS];
+
+static const uint8_t functions[] = {
+    READ_COIL_STATUS, READ_INPUT_STATUS, READ_HOLDING_REGISTERS, READ_INPUT_REGISTERS,
+    FORCE_SINGLE_COIL, PRESET_SINGLE_REGISTER, FORCE_MULTIPLE_COILS, PRESET_MULTIPLE_REGISTERS,
+    MASK_WRITE_REGISTER, READ_WRITE_MULTIPLE_REGISTERS
+};
+
+//Registers a response may write into
+static uint16_t written(const Packet* packet)
+{
+    switch (packet->function)
+    {
+        case READ_COIL_STATUS:
+        case READ_INPUT_STATUS:
+            return (packet->data + 15) / 16;
+        case READ_HOLDING_REGISTERS:
+        case READ_INPUT_REGISTERS:
+        case READ_WRITE_MULTIPLE_REGISTERS:
+            return packet->data;
+        default:
+            return 0;
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    uint8_t frame[256];
+    Packet packet;
+
+    if (size < 3)
+        return 0;
+    if (size - 3 > sizeof(frame))
+        size = sizeof(frame) + 3;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.id = 1;
+    packet.function = functions[data[0] % sizeof(functions)];
+    packet.data = data[1];
+    uint8_t flags = data[2];
+    size -= 3;
+    memcpy(frame, data + 3, size);
+
+    if ((flags & 2) && size >= 5)
+    {
+        frame[1] = packet.function;
+        uint16_t bytes = written(&packet) * 2;
+        if (packet.function == READ_COIL_STATUS || packet.function == READ_INPUT_STATUS)
+            bytes = (packet.data + 7) / 8;
+        if (bytes && bytes + 5 <= size)
+        {
+            frame[2] = bytes;
+            size = bytes + 5;
+        }
+    }
+    if ((flags & 1) && size >= 3)
+    {
+        frame[0] = packet.id;
+        uint16_t crc = crc16(frame, size - 2);
+        frame[size - 2] = crc & 0xFF;
+        frame[size - 1] = crc >> 8;
+    }
+
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+        regs[i] = GUARD;
+    master.decode(&packet, frame, size > 255 ? 255 : size, regs + GUARD_WORDS);
+
+    uint16_t end = GUARD_WORDS + written(&packet);
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+        if ((i < GUARD_WORDS || i >= end) && regs[i] != GUARD)
+            abort();
+    return 0;
+}
+
+#ifndef MODBUS_LIBFUZZER
+int main(int argc, char** argv)
+{
+    uint8_t input[3 + 256];
+
+    //Given inputs, e.g. a crash found by libFuzzer
+    for (int i = 1; i < argc; i++)
+    {
+        FILE* file = fopen(argv[i], "rb");
+        if (!file)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        size_t size = fread(input, 1, sizeof(input), file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(input, size);
+    }
+    if (argc > 1)
+    {
+        printf("PASS\n");
+        return 0;
+    }
+
+    //Random inputs, two of three with valid ID and CRC, one of three also with valid header
+    srand(1);
+    for (long i = 0; i < 1000000; i++)
+    {
+        size_t size = 3 + rand() % 80;
+        for (size_t j = 0; j < size; j++)
+            input[j] = rand();
+        input[1] %= 64;
+        input[2] = (i % 3) ? (i % 3) * 2 - 1 : 0;
+        LLVMFuzzerTestOneInput(input, size);
+    }
+    printf("PASS\n");
+    return 0;
+}
+#endif
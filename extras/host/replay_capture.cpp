@@ -0,0 +1,69 @@
+// Replay a capture dump against the frame decoder of Modbus::replay() on a PC
+// Usage: replay_capture file [loops], it is built by run_tests.sh
+// file holds capture records as written by capture_dump(), e.g. saved from Serial of
+// the ModbusXT_Replay example. Frames/s of the decoder is printed after loops replays.
+#include "FakeSlave.h"
+#include <chrono>
+
+int main(int argc, char** argv)
+{
+    static Modbus master;
+    uint16_t regs[BUFFER_SIZE / 2];
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s file [loops]\n", argv[0]);
+        return 2;
+    }
+    long loops = argc > 2 ? atol(argv[2]) : 1;
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> trace;
+    int c;
+    while ((c = fgetc(file)) != EOF)
+        trace.push_back(c);
+    fclose(file);
+
+    //replay() takes up to 65535 bytes, a longer dump is cut at record boundaries
+    std::vector<size_t> chunks;
+    size_t records = 0;
+    size_t start = 0, index = 0;
+    while (index + CAPTURE_HEADER <= trace.size())
+    {
+        size_t next = index + CAPTURE_HEADER + trace[index + 5];
+        if (next > trace.size())
+            break;
+        if (next - start > 0xFFFF)
+        {
+            chunks.push_back(index);
+            start = index;
+        }
+        index = next;
+        records++;
+    }
+    chunks.push_back(index);
+    if (index != trace.size())
+        fprintf(stderr, "%s: %u bytes of truncated record ignored\n", argv[1], (unsigned)(trace.size() - index));
+
+    unsigned long frames = 0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (long i = 0; i < loops; i++)
+    {
+        start = 0;
+        for (size_t j = 0; j < chunks.size(); j++)
+        {
+            frames += master.replay(&trace[0] + start, chunks[j] - start, regs);
+            start = chunks[j];
+        }
+    }
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - begin;
+
+    printf("records: %u\tframes: %lu\ttime(us): %lu\tframes/s: %.0f\n", (unsigned)records, frames,
+           (unsigned long)(elapsed.count() / 1000), elapsed.count() ? frames * 1e9 / elapsed.count() : 0.0);
+    return frames ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#!/bin/sh
+# Build and run the decoder benchmark of ModbusXT with g++
+# Usage: extras/host/run_bench.sh [build directory], default /tmp/modbusxt_host
+
+HOST=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HOST/../.." && pwd)
+OUT=${1:-/tmp/modbusxt_host}
+CXX=${CXX:-g++}
+mkdir -p "$OUT"
+
+$CXX -std=gnu++11 -O2 -Wall -Wno-sign-compare -Wno-unused-parameter -I"$HOST" -I"$ROOT" \
+    "$HOST/bench_decode.cpp" "$ROOT/ModbusXT.cpp" -o "$OUT/bench_decode" || exit 1
+exec "$OUT/bench_decode"
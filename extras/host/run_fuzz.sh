@@ -0,0 +1,16 @@
+#!/bin/sh
+# Fuzz the response decoder of ModbusXT with libFuzzer, clang is needed
+# Usage: extras/host/run_fuzz.sh [build directory] [libFuzzer options], e.g. -max_total_time=60
+# A crash input is saved by libFuzzer, replay it with the g++ build of run_tests.sh:
+#   /tmp/modbusxt_host/fuzz_decode crash-<hash>
+
+HOST=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HOST/../.." && pwd)
+OUT=${1:-/tmp/modbusxt_host}
+[ $# -gt 0 ] && shift
+CXX=${CXX:-clang++}
+mkdir -p "$OUT/corpus"
+
+$CXX -std=gnu++11 -O1 -g -fsanitize=fuzzer,address,undefined -DMODBUS_LIBFUZZER -I"$HOST" -I"$ROOT" \
+    "$HOST/fuzz_decode.cpp" "$ROOT/ModbusXT.cpp" -o "$OUT/fuzz_decode_libfuzzer" || exit 1
+exec "$OUT/fuzz_decode_libfuzzer" "$@" "$OUT/corpus"
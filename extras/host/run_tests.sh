@@ -0,0 +1,59 @@
+#!/bin/sh
+# Build and run the host tests of ModbusXT with g++, no Arduino board needed
+# Usage: extras/host/run_tests.sh [build directory], default /tmp/modbusxt_host
+# Arduino.h, SPI.h and Ethernet.h are host stubs, examples build against them too
+# Compile flags of ModbusXT.h are set per test, see the first line of each test
+
+HOST=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HOST/../.." && pwd)
+OUT=${1:-/tmp/modbusxt_host}
+CXX=${CXX:-g++}
+mkdir -p "$OUT"
+
+passed=0
+failed=""
+
+# run name "flags" [arguments]
+run()
+{
+    name=$1
+    flags=$2
+    shift 2
+    if $CXX -std=gnu++11 -O2 -Wall -Wno-sign-compare -Wno-unused-parameter -I"$HOST" -I"$ROOT" $flags \
+            "$HOST/$name.cpp" "$ROOT/ModbusXT.cpp" -o "$OUT/$name" 2> "$OUT/$name.log" &&
+       timeout 120 "$OUT/$name" "$@" >> "$OUT/$name.log" 2>&1
+    then
+        passed=$((passed + 1))
+        echo "ok     $name"
+    else
+        failed="$failed $name"
+        echo "FAILED $name, see $OUT/$name.log"
+    fi
+}
+
+run test_group "-DMODBUS_GROUP=1"
+run test_replay_state "-DMODBUS_CAPTURE=1 -DMODBUS_TRACE=1"
+run test_queue ""
+run test_capture "-DMODBUS_CAPTURE=1" "$OUT/capture.bin"
+run replay_capture "" "$OUT/capture.bin" 1000
+run test_sim_writes ""
+run test_mask_write ""
+run test_points ""
+run test_packet_table "-DMODBUS_GROUP=1"
+run test_retry_limit ""
+run test_decode ""
+run fuzz_decode ""
+run test_submit_threads "-pthread"
+run test_submit_transaction ""
+run test_event "-DSTUB_REALTIME -pthread"
+run test_event_bus "-DSTUB_REALTIME -pthread" 1 1
+run test_wake ""
+run test_reconfigure ""
+run test_trace "-DMODBUS_TRACE=1" "$OUT/trace.bin"
+run test_block ""
+run test_changes ""
+run test_history ""
+run test_coalesce "-DMODBUS_GROUP=1"
+
+echo "$passed passed, failed:${failed:- none}"
+[ -z "$failed" ]
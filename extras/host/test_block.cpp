@@ -0,0 +1,73 @@
+// Block transfer of a dead slave fails, of a live slave delivers all chunks; bad blocks are refused
+#include "ModbusXT.h"
+#include "ModbusXT_Sim.h"
+#include <assert.h>
+
+unsigned long stub_us;
+HardwareSerial Serial, Serial1;
+SimSlave sim_slaves[1];
+uint16_t image[64];
+ModbusSimBus bus;
+ModbusVirtualClock clock_;
+Modbus master;
+uint16_t regs[8];
+Packet packets[1];
+int chunks = 0;
+
+void sink(ModbusBlock* block, uint16_t offset, uint16_t* registers, uint8_t count)
+{
+    chunks++;
+}
+
+int main()
+{
+    memset(sim_slaves, 0, sizeof(sim_slaves));
+    sim_slaves[0].id = 1;
+    sim_slaves[0].latency_min = 1000;
+    sim_slaves[0].latency_max = 2000;
+    bus.clock(&clock_);
+    bus.begin(sim_slaves, 1, image, 64, 57600);
+    master.clock(&clock_);
+    master.configure(packets, 0, regs);
+    master.begin(&bus, 57600, 50, 2, 3, 2);
+
+    ModbusBlock block;
+    memset(&block, 0, sizeof(block));
+    block.id = 9;
+    block.function = READ_INPUT_REGISTERS;
+    block.address = 0;
+    block.count = 100;
+    block.data = sink;
+    block.share = 30;
+    assert(master.transfer(&block));
+    assert(!master.transfer(&block));   //already running
+    while (block.status == REQUEST_PENDING)
+        clock_.step(&master, &bus);
+    assert(block.status == REQUEST_FAILED && block.done == 0 && chunks == 0);
+
+    block.id = 1;
+    assert(master.transfer(&block));
+    while (block.status == REQUEST_PENDING)
+        clock_.step(&master, &bus);
+    printf("done %u registers in %d chunks, rate %lu\n", block.done, chunks, master.transfer_rate(&block));
+    assert(block.status == REQUEST_DONE && block.done == 100 && chunks == 4);
+
+    block.count = 0;
+    assert(!master.transfer(&block));   //empty range
+
+    //Bits would be packed into master registers, not into the block
+    block.count = 10;
+    block.function = READ_COIL_STATUS;
+    assert(!master.transfer(&block));
+    block.function = PRESET_SINGLE_REGISTER;
+    assert(!master.transfer(&block));
+
+    //Range past register 0xFFFF
+    block.function = READ_HOLDING_REGISTERS;
+    block.address = 0xFFF0;
+    block.count = 0x11;
+    assert(!master.transfer(&block));
+    block.count = 0x10;
+    assert(master.transfer(&block));
+    printf("PASS\n");
+}
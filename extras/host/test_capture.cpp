@@ -0,0 +1,45 @@
+// Capture of bus traffic is replayed into a scratch register array (MODBUS_CAPTURE=1)
+// Usage: test_capture [file], capture is also dumped to file for replay_capture
+#include "FakeSlave.h"
+
+//Print into a file, as Serial of a board into a terminal log
+struct FilePrint : public Print {
+    FILE* file;
+    FilePrint(FILE* f) : file(f) {}
+    size_t write(uint8_t c) { return fputc(c, file) == EOF ? 0 : 1; }
+};
+
+int main(int argc, char** argv)
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[32] = {0};
+    Packet packets[2];
+    static uint8_t capture[600];
+    uint16_t scratch[32] = {0};
+
+    memset(packets, 0, sizeof(packets));
+    master.configure(packets, 2, regs);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 6, 0);
+    master.construct(&packets[1], 1, PRESET_MULTIPLE_REGISTERS, 100, 4, 6);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 2, 3, 2);
+    master.capture(true);
+    run(master, 3000);
+
+    uint16_t size = master.capture_read(capture, sizeof(capture));
+    uint16_t failed = master.total_failed();
+    uint16_t frames = master.replay(capture, size, scratch);
+    printf("captured %u bytes, replayed %u frames\n", size, frames);
+    assert(frames > 10 && scratch[5] == 50);
+    assert(master.total_failed() == failed);
+
+    if (argc > 1)
+    {
+        FILE* file = fopen(argv[1], "wb");
+        assert(file);
+        FilePrint out(file);
+        assert(master.capture_dump(&out) == size);
+        fclose(file);
+    }
+    printf("PASS\n");
+}
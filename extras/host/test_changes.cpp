@@ -0,0 +1,30 @@
+// Changed registers are found in order through the change bits
+#include "ModbusXT.h"
+#include <assert.h>
+
+unsigned long stub_us;
+HardwareSerial Serial, Serial1;
+Modbus master;
+uint16_t regs[70];
+ChangeWord changes[CHANGE_WORDS(70)];
+
+int main()
+{
+    uint16_t changed[] = {0, 5, 31, 32, 33, 63, 64, 69};
+
+    master.configure((Packet*)NULL, 0, regs);
+    master.watch(changes, 70);
+    for (int i = 0; i < 8; i++)
+        changes[changed[i] / CHANGE_BITS] |= (ChangeWord)1 << (changed[i] % CHANGE_BITS);
+
+    uint16_t index = 0;
+    int found = 0;
+    while (master.next_change(&index))
+        assert(index == changed[found++]);
+    assert(found == 8);
+
+    //Bits are cleared when they are found
+    index = 0;
+    assert(!master.next_change(&index));
+    printf("PASS\n");
+}
@@ -0,0 +1,123 @@
+// Neighbour single writes are sent as one multiple write, each packet keeps its statistics
+// and callback (MODBUS_GROUP=1)
+#include "FakeSlave.h"
+
+int succeeded[16], failed[16];
+Packet* base;
+
+void finished(Packet* packet, bool success)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        if (base[i].id == packet->id && base[i].function == packet->function && base[i].address == packet->address)
+        {
+            (success ? succeeded : failed)[i]++;
+            return;
+        }
+    }
+    assert(0);
+}
+
+//Packets of a Packet array, or of a packet table
+void test(bool table)
+{
+    FakeSlave slave;
+    static Modbus array_master, table_master;
+    Modbus& master = table ? table_master : array_master;
+    uint16_t regs[64] = {0};
+    Packet packets[16];
+    static PacketConfig config[16];
+    static PacketState states[16];
+
+    memset(packets, 0, sizeof(packets));
+    memset(succeeded, 0, sizeof(succeeded));
+    memset(failed, 0, sizeof(failed));
+    base = packets;
+
+    //Ten function 6 to neighbour addresses, registers in reverse order
+    for (int i = 0; i < 10; i++)
+    {
+        master.construct(&packets[i], 1, PRESET_SINGLE_REGISTER, 10 + i, 0, 40 - i);
+        regs[40 - i] = 1000 + i;
+    }
+    master.construct(&packets[10], 1, PRESET_SINGLE_REGISTER, 21, 0, 20);   //gap in address
+    regs[20] = 77;
+    master.construct(&packets[11], 2, PRESET_SINGLE_REGISTER, 22, 0, 21);   //other slave
+    regs[21] = 88;
+    for (int i = 0; i < 3; i++)
+        master.construct(&packets[12 + i], 1, FORCE_SINGLE_COIL, 5 + i, i == 1 ? COIL_OFF : COIL_ON, 0);
+    master.construct(&packets[15], 1, READ_HOLDING_REGISTERS, 10, 10, 0);
+
+    if (table)
+    {
+        memset(states, 0, sizeof(states));
+        for (int i = 0; i < 16; i++)
+        {
+            config[i].id = packets[i].id;
+            config[i].function = packets[i].function;
+            config[i].address = packets[i].address;
+            config[i].data = packets[i].data;
+            config[i].register_start_address = packets[i].register_start_address;
+            states[i].connection = 1;
+        }
+        master.configure(config, states, 16, regs);
+    }
+    else
+        master.configure(packets, 16, regs);
+    master.callback(finished);
+    master.coalesce(true);
+    slave.coils[6] = 1;
+    master.begin(&slave, 57600, SERIAL_8E1, 100, 2, 3, 2);
+    run(master, 4000);
+
+    int single = 0;
+    size_t most = 0;
+    for (size_t i = 0; i < slave.log.size(); i++)
+    {
+        std::vector<uint8_t>& frame = slave.log[i];
+        if (frame[1] == PRESET_MULTIPLE_REGISTERS && (size_t)((frame[4] << 8) | frame[5]) > most)
+            most = (frame[4] << 8) | frame[5];
+        single += (frame[1] == FORCE_SINGLE_COIL);
+    }
+    assert(most == 8 && single == 0 && master.total_failed() == 0);
+    for (int i = 0; i < 10; i++)
+        assert(slave.hold[10 + i] == 1000 + i);
+    assert(slave.hold[21] == 77 && slave.hold[22] == 88);
+    assert(slave.coils[5] == 1 && slave.coils[6] == 0 && slave.coils[7] == 1);
+    assert(regs[0] == 1000 && regs[9] == 1009);
+    for (int i = 0; i < 16; i++)
+    {
+        uint16_t successful = table ? states[i].successful_requests : packets[i].successful_requests;
+        uint16_t requests = table ? states[i].requests : packets[i].requests;
+        assert(successful > 0 && successful == requests && succeeded[i] == successful);
+    }
+    uint16_t rounds = table ? states[15].requests : packets[15].requests;
+    printf("table %d: %.2f transactions per cycle of 16 packets\n", table, (double)master.total_requests() / rounds);
+
+    //Silent slave: each write fails on its own
+    slave.silent = true;
+    run(master, 20000);
+    for (int i = 0; i < 15; i++)
+        assert(failed[i] == 1);
+}
+
+int main()
+{
+    test(false);
+    test(true);
+
+    //Without coalesce every write is sent alone
+    FakeSlave slave;
+    static Modbus master;
+    uint16_t regs[8] = {1, 2, 3};
+    Packet packets[3];
+    memset(packets, 0, sizeof(packets));
+    for (int i = 0; i < 3; i++)
+        master.construct(&packets[i], 1, PRESET_SINGLE_REGISTER, i, 0, i);
+    master.configure(packets, 3, regs);
+    master.begin(&slave, 57600, SERIAL_8E1, 100, 2, 3, 2);
+    run(master, 500);
+    for (size_t i = 0; i < slave.log.size(); i++)
+        assert(slave.log[i][1] == PRESET_SINGLE_REGISTER);
+    printf("PASS\n");
+}
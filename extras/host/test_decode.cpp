@@ -0,0 +1,48 @@
+// Random and corrupted frames never write outside the registers of the packet
+#include "FakeSlave.h"
+
+int main()
+{
+    Modbus master;
+    uint16_t regs[40];
+    uint8_t frame[80];
+    Packet packet;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.id = 1;
+    packet.function = READ_HOLDING_REGISTERS;
+    packet.data = 4;
+    srand(1);
+
+    long accepted = 0;
+    for (long i = 0; i < 2000000; i++)
+    {
+        int size = rand() % 70;
+        for (int j = 0; j < size; j++)
+            frame[j] = rand();
+
+        //Every third frame is a valid response, half of them with one bit flipped
+        if (i % 3 == 0)
+        {
+            size = 5 + 8;
+            frame[0] = 1;
+            frame[1] = READ_HOLDING_REGISTERS;
+            frame[2] = 8;
+            uint16_t crc = crc16(frame, size - 2);
+            frame[size - 2] = crc & 0xFF;
+            frame[size - 1] = crc >> 8;
+            if (rand() % 2)
+                frame[rand() % size] ^= 1 << (rand() % 8);
+        }
+
+        for (int j = 0; j < 40; j++)
+            regs[j] = 0xBEEF;
+        accepted += master.decode(&packet, frame, size, regs + 8);
+        for (int j = 0; j < 8; j++)
+            assert(regs[j] == 0xBEEF);
+        for (int j = 12; j < 40; j++)
+            assert(regs[j] == 0xBEEF);
+    }
+    printf("accepted %ld\n", accepted);
+    printf("PASS\n");
+}
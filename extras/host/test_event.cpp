@@ -0,0 +1,43 @@
+// ModbusEvent on the monotonic clock: time out, pending signal, signal from another thread (STUB_REALTIME)
+#include <Arduino.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ModbusXT_OS.h"
+
+unsigned long stub_us;
+HardwareSerial Serial, Serial1;
+ModbusEvent event;
+
+void* late(void*)
+{
+    usleep(50000);
+    event.signal();
+    return NULL;
+}
+
+int main()
+{
+    event.begin();
+
+    unsigned long start = micros();
+    assert(!event.wait(100000));
+    unsigned long waited = micros() - start;
+    assert(waited >= 100000 && waited < 150000);
+
+    //Many signals before a wait count as one
+    event.signalFromISR();
+    event.signal();
+    assert(event.wait(0));
+    assert(!event.wait(0));
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, late, NULL);
+    start = micros();
+    assert(event.wait(1000000));
+    waited = micros() - start;
+    pthread_join(thread, NULL);
+    printf("woken after %lu us\n", waited);
+    assert(waited >= 50000 && waited < 150000);
+    printf("PASS\n");
+}
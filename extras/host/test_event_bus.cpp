@@ -0,0 +1,153 @@
+// Master task blocks on ModbusEvent against a serial port with real timing (STUB_REALTIME)
+// Usage: test_event_bus [mode] [adaptive], mode 0 spins, 1 blocks and is woken by received(),
+// 2 blocks and polls. Prints transactions per second and CPU time of the master task
+#include "FakeSlave.h"
+#include "ModbusXT_OS.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+
+//Slave thread answers after latency, one byte per byte time, like a UART
+struct Wire : public HardwareSerial {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    std::vector<uint8_t> tx, rx;
+    std::vector<unsigned long> arrival;     //time of each response byte
+    size_t rxpos = 0;
+    bool have_request = false;
+    FakeSlave slave;
+    Modbus* master = NULL;
+    bool notify = false;    //call received() for each byte
+    int byte_us = 191;
+    int latency_us = 2000;
+    std::atomic<bool> stop{false};
+
+    size_t write(uint8_t c) { tx.push_back(c); return 1; }
+    using Print::write;
+
+    //Flush spins while request is sent
+    void flush()
+    {
+        delayMicroseconds(tx.size() * byte_us);
+        slave.tx = tx;
+        slave.respond();
+        tx.clear();
+
+        pthread_mutex_lock(&mutex);
+        rx = slave.rx;
+        rxpos = 0;
+        arrival.clear();
+        unsigned long t = micros() + latency_us;
+        for (size_t i = 0; i < rx.size(); i++)
+            arrival.push_back(t += byte_us);
+        have_request = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    int available()
+    {
+        pthread_mutex_lock(&mutex);
+        unsigned long now = micros();
+        size_t n = rxpos;
+        while (n < rx.size() && (long)(now - arrival[n]) >= 0)
+            n++;
+        pthread_mutex_unlock(&mutex);
+        return n - rxpos;
+    }
+
+    int read()
+    {
+        if (!available())
+            return -1;
+        pthread_mutex_lock(&mutex);
+        int c = rx[rxpos++];
+        pthread_mutex_unlock(&mutex);
+        return c;
+    }
+
+    int peek() { return -1; }
+
+    //Receive interrupt of each byte, it may come late but data is already there
+    void loop()
+    {
+        while (!stop)
+        {
+            pthread_mutex_lock(&mutex);
+            while (!have_request && !stop)
+                pthread_cond_wait(&cond, &mutex);
+            have_request = false;
+            std::vector<unsigned long> times = arrival;
+            pthread_mutex_unlock(&mutex);
+            if (stop)
+                break;
+
+            for (size_t i = 0; i < times.size(); i++)
+            {
+                long wait = times[i] - micros();
+                if (wait > 0)
+                    usleep(wait);
+                if (notify)
+                    master->received();
+            }
+        }
+    }
+
+    static void* thread(void* wire)
+    {
+        ((Wire*)wire)->loop();
+        return NULL;
+    }
+};
+
+Wire wire;
+Modbus master;
+uint16_t regs[64];
+Packet packets[2];
+ModbusEvent event;
+Turnaround guards[4];
+
+int main(int argc, char** argv)
+{
+    int mode = argc > 1 ? atoi(argv[1]) : 1;
+    int adaptive = argc > 2 ? atoi(argv[2]) : 1;
+
+    master.configure(packets, 2, regs);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 10, 0);
+    master.construct(&packets[1], 1, PRESET_MULTIPLE_REGISTERS, 100, 4, 20);
+    master.begin(&wire, 57600, SERIAL_8E1, 500, adaptive ? 0 : 10, 3, 2);
+    if (adaptive)
+        master.gap(GAP_ADAPTIVE, guards, 4);
+    wire.master = &master;
+    wire.notify = (mode == 1);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, Wire::thread, &wire);
+    event.begin();
+    if (mode)
+        master.wake(ModbusEvent::wake, ModbusEvent::wakeFromISR, &event);
+
+    timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    unsigned long start = micros();
+    while (micros() - start < 3000000UL)
+    {
+        master.update();
+        if (mode)
+            event.wait(master.idle());
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+
+    wire.stop = true;
+    pthread_mutex_lock(&wire.mutex);
+    pthread_cond_signal(&wire.cond);
+    pthread_mutex_unlock(&wire.mutex);
+    pthread_join(thread, NULL);
+
+    double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+    printf("mode %d adaptive %d: %.1f transactions/s, failed %u, cpu %.1f%%\n",
+           mode, adaptive, master.total_requests() / 3.0, master.total_failed(), cpu / 3 * 100);
+    assert(master.total_requests() > 0 && master.total_failed() == 0);
+    assert(regs[1] == 10 && regs[2] == 20);
+    printf("PASS\n");
+}
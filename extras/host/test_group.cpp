@@ -0,0 +1,26 @@
+// Transaction group: write and read of the same slave are sent as one function 23 (MODBUS_GROUP=1)
+#include "FakeSlave.h"
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[32] = {0};
+    Packet packets[3];
+
+    memset(packets, 0, sizeof(packets));
+    master.configure(packets, 3, regs);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 6, 0);
+    master.construct(&packets[1], 1, PRESET_MULTIPLE_REGISTERS, 100, 4, 6);
+    master.construct(&packets[2], 1, READ_HOLDING_REGISTERS, 100, 4, 12);
+    for (int i = 6; i < 10; i++)
+        regs[i] = 1000 + i;
+    master.fuse(true);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 2, 3, 2);
+    run(master, 3000);
+
+    assert(slave.log[0][1] == READ_WRITE_MULTIPLE_REGISTERS && slave.log[1][1] == READ_HOLDING_REGISTERS);
+    assert(regs[5] == 50 && regs[12] == 1006 && regs[15] == 1009);
+    assert(packets[0].successful_requests == packets[1].successful_requests);
+    printf("PASS\n");
+}
@@ -0,0 +1,102 @@
+// History ring keeps the newest samples across a clock wrap and finds time ranges
+#include "ModbusXT_History.h"
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+#include <chrono>
+
+unsigned long stub_us = 0;
+HardwareSerial Serial, Serial1;
+
+struct Sample {
+    uint32_t time;
+    uint16_t start;
+    std::vector<uint16_t> values;
+};
+std::vector<Sample> found;
+
+void collect(unsigned long time, uint16_t start, const uint16_t* values, uint8_t count, void*)
+{
+    Sample sample = {(uint32_t)time, start, std::vector<uint16_t>(values, values + count)};
+    found.push_back(sample);
+}
+
+int main()
+{
+    static uint8_t buffer[2048];
+    static uint16_t state[2 * 64];
+    ModbusHistory history;
+
+    assert(!history.begin(buffer, 300, state, 64));     //too small
+    assert(history.begin(buffer, sizeof(buffer), state, 64));
+    assert(!history.record(0, 60, state, 5));           //outside of register range
+
+    std::vector<Sample> all;
+    uint16_t values[8] = {0};
+    uint32_t time = 0xFFFFF000UL;   //clock wraps during the run
+    srand(1);
+    for (int i = 0; i < 5000; i++)
+    {
+        uint16_t start = (i % 3) * 8;
+        uint8_t count = 1 + (i % 8);
+        for (int k = 0; k < count; k++)
+            values[k] = (i % 50 == 0) ? rand() : (uint16_t)(values[k] + (rand() % 5) - 2);
+        time += 50 + rand() % 200;
+        assert(history.record(time, start, values, count));
+        Sample sample = {time, start, std::vector<uint16_t>(values, values + count)};
+        all.push_back(sample);
+    }
+
+    //Whole ring, oldest samples are dropped
+    found.clear();
+    uint16_t n = history.query(time - 0x7FFFFFFFUL, time, collect, NULL);
+    size_t kept = all.size() - history.dropped();
+    printf("samples %u, dropped %u, span %lu, ratio %.2f\n", history.samples(), history.dropped(), history.span(), (double)history.raw_bytes() / history.stored_bytes());
+    assert(n == kept);
+    for (size_t i = 0; i < kept; i++)
+    {
+        const Sample& a = all[history.dropped() + i];
+        const Sample& b = found[i];
+        assert(a.time == b.time && a.start == b.start && a.values == b.values);
+    }
+
+    //Part of the ring
+    uint32_t from = all[all.size() - 100].time, to = all[all.size() - 20].time;
+    found.clear();
+    n = history.query(from, to, collect, NULL);
+    assert(n == 81 && found[0].time == from && found.back().time == to);
+
+    //Coils of a packet are one value per coil, writes are not recorded
+    Packet packet;
+    uint16_t regs[64] = {0};
+    memset(&packet, 0, sizeof(packet));
+    packet.function = READ_COIL_STATUS;
+    packet.data = 17;
+    packet.register_start_address = 4;
+    regs[4] = 5;
+    regs[5] = 1;
+    assert(history.record(time + 1, &packet, regs));
+    found.clear();
+    history.query(time + 1, time + 1, collect, NULL);
+    assert(found.size() == 1 && found[0].values.size() == 2 && found[0].values[1] == 1);
+    packet.function = PRESET_SINGLE_REGISTER;
+    assert(!history.record(time + 2, &packet, regs));
+
+    //Insert rate of a slowly changing meter
+    ModbusHistory meter;
+    static uint8_t meter_buffer[2048];
+    meter.begin(meter_buffer, sizeof(meter_buffer), state, 64);
+    uint16_t meter_values[6] = {1000, 20, 30, 0, 1, 2};
+    unsigned long meter_time = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000000; i++)
+    {
+        meter_values[0] += (i & 3) - 1;
+        meter_values[5] = i & 3;
+        meter_time += 250;
+        meter.record(meter_time, 0, meter_values, 6);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("insert %.0f samples/s, ratio %.2f\n", 1e6 / us * 1e6, (double)meter.raw_bytes() / meter.stored_bytes());
+    printf("PASS\n");
+}
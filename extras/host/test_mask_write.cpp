@@ -0,0 +1,30 @@
+// Bits of a register are set and cleared with one function 22
+#include "FakeSlave.h"
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[32] = {0};
+    Packet packets[1], control;
+    QueuedPacket slots[4];
+
+    memset(packets, 0, sizeof(packets));
+    memset(&control, 0, sizeof(control));
+    master.configure(packets, 1, regs);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 6, 0);
+    master.construct(&control, 1, MASK_WRITE_REGISTER, 50, 0, 20);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 2, 3, 2);
+    slave.hold[50] = 0x00F0;
+    run(master, 100);
+
+    master.queue(slots, 4);
+    master.bit_set(&control, 0);
+    master.bit_clear(&control, 4);
+    master.bit_set(&control, 15);
+    assert(master.queued() == 1);
+    run(master, 1000);
+
+    assert(slave.hold[50] == 0x80E1 && control.successful_requests == 1);
+    printf("PASS\n");
+}
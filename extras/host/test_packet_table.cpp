@@ -0,0 +1,28 @@
+// Packet table: configuration in flash, state in RAM, with a transaction group (MODBUS_GROUP=1)
+#include "FakeSlave.h"
+
+const PacketConfig table[] PROGMEM = {
+    {1, READ_HOLDING_REGISTERS, 0, 6, 0},
+    {1, PRESET_MULTIPLE_REGISTERS, 100, 4, 6},
+    {2, READ_HOLDING_REGISTERS, 0, 2, 12},
+    {1, PRESET_SINGLE_REGISTER, 150, 0, 6},
+};
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[32] = {0};
+    PacketState states[4];
+
+    master.configure_P(table, states, 4, regs);
+    master.fuse(true);
+    for (int i = 6; i < 10; i++)
+        regs[i] = 1000 + i;
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 2, 3, 2);
+    run(master, 3000);
+
+    printf("sizeof Packet %zu, PacketState %zu, PacketConfig %zu\n", sizeof(Packet), sizeof(PacketState), sizeof(PacketConfig));
+    assert(regs[5] == 50 && slave.hold[100] == 1006 && slave.hold[150] == 1006);
+    printf("PASS\n");
+}
@@ -0,0 +1,43 @@
+// Typed points are decoded from the registers of a map
+#include "FakeSlave.h"
+
+struct { int32_t energy; float power; int16_t temperature; float scaled; uint16_t raw; } meter;
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[32] = {0};
+    Packet packets[1];
+    PointMap meter_map;
+    Point points[] = {
+        modbusPoint<int32_t, ORDER_CDAB>("energy", 0, meter.energy),
+        modbusPoint<float, ORDER_ABCD>("power", 2, meter.power),
+        modbusPoint<int16_t, ORDER_ABCD>("temperature", 4, meter.temperature),
+        modbusPoint<int16_t, ORDER_ABCD>("scaled", 4, meter.scaled, 0.1),
+        modbusPoint<uint16_t, ORDER_BADC>("raw", 5, meter.raw),
+    };
+
+    memset(packets, 0, sizeof(packets));
+    master.configure(packets, 1, regs);
+    master.map(&meter_map, points, 5, 10);
+    master.map(&meter_map, points, 5, 10);  //mapped once
+    assert(meter_map.next == NULL);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 6, 10);
+
+    float power = 3.5f;
+    uint32_t bits;
+    memcpy(&bits, &power, sizeof(bits));
+    slave.hold[0] = 0x5678;
+    slave.hold[1] = 0x1234;
+    slave.hold[2] = bits >> 16;
+    slave.hold[3] = bits & 0xFFFF;
+    slave.hold[4] = (uint16_t)-123;
+    slave.hold[5] = 0x0102;
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 2, 3, 2);
+    run(master, 200);
+
+    assert(meter.energy == 0x12345678 && meter.power == 3.5f && meter.temperature == -123 && meter.raw == 0x0201);
+    assert(fabs(meter.scaled - -12.3f) < 0.001f);
+    printf("PASS\n");
+}
@@ -0,0 +1,34 @@
+// One-shot packets: the higher priority packet is sent first, ahead of the cyclic scan
+#include "FakeSlave.h"
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[32] = {0};
+    Packet packets[2], estop, coil;
+    QueuedPacket slots[4];
+
+    master.configure(packets, 2, regs);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 6, 0);
+    master.construct(&packets[1], 1, PRESET_MULTIPLE_REGISTERS, 100, 4, 6);
+    master.construct(&estop, 1, PRESET_SINGLE_REGISTER, 200, 0, 20);
+    master.construct(&coil, 1, FORCE_SINGLE_COIL, 5, COIL_ON, 0);
+    regs[20] = 0xAB;
+    master.queue(slots, 4);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 2, 3, 2);
+    run(master, 200);
+
+    assert(master.send(&coil, 0));
+    assert(master.send(&estop, 5));
+    assert(master.queued() == 2);
+    size_t before = slave.log.size();
+    run(master, 2000);
+
+    assert(slave.log[before][1] == PRESET_SINGLE_REGISTER);
+    assert(slave.log[before + 1][1] == FORCE_SINGLE_COIL);
+    assert(slave.hold[200] == 0xAB && slave.coils[5]);
+    assert(estop.successful_requests == 1);
+    printf("queue latency max %lu us\n", master.queue_latency_max());
+    printf("PASS\n");
+}
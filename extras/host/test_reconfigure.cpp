@@ -0,0 +1,40 @@
+// Packet list is swapped at a transaction boundary, packets which stay keep their statistics
+#include "FakeSlave.h"
+
+FakeSlave slave;
+Modbus master;
+uint16_t regs[64];
+PacketConfig config_a[3] = {{1, 3, 0, 2, 0}, {1, 3, 10, 2, 2}, {1, 6, 20, 0, 4}};
+PacketState states_a[3];
+PacketConfig config_b[3] = {{1, 3, 10, 2, 2}, {1, 6, 20, 0, 4}, {1, 3, 30, 2, 6}};
+PacketState states_b[3];
+Packet packets[2];
+
+int main()
+{
+    master.configure(config_a, states_a, 3, regs);
+    master.begin(&slave, 57600, SERIAL_8E1, 100, 0, 3, 2);
+    run(master, 2000);
+    unsigned requests_1 = states_a[1].requests, requests_2 = states_a[2].requests;
+
+    memset(states_b, 0xAA, sizeof(states_b));
+    assert(master.reconfigure(config_b, states_b, 3, regs));
+    assert(!master.reconfigure(config_b, states_b, 3, regs));   //one swap at a time
+    while (!master.reconfigured())
+        run(master, 1);
+    assert(states_b[0].requests >= requests_1 && states_b[1].requests >= requests_2);
+    assert(states_b[2].requests <= 1 && states_b[2].failed_requests == 0);
+    run(master, 2000);
+    assert(states_b[2].successful_requests > 0);
+
+    //Packet array keeps the packet at address 30
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 30, 2, 6);
+    master.construct(&packets[1], 2, READ_HOLDING_REGISTERS, 0, 1, 8);
+    packets[0].requests = 999;
+    unsigned requests_30 = states_b[2].requests;
+    master.reconfigure(packets, 2, regs);
+    while (!master.reconfigured())
+        run(master, 1);
+    assert(packets[0].requests >= requests_30 && packets[0].requests < requests_30 + 2 && packets[1].requests <= 1);
+    printf("PASS\n");
+}
@@ -0,0 +1,77 @@
+// Replay leaves turnaround guards, trace ring and point targets of the live master as they are
+// (MODBUS_CAPTURE=1, MODBUS_TRACE=1)
+#define private public     //trace ring is compared byte by byte
+#include "FakeSlave.h"
+#undef private
+
+std::vector<uint8_t> capture;
+
+//Append a capture record, a response gets its CRC, broken if bad
+void record(uint8_t direction, std::vector<uint8_t> frame, bool bad = false)
+{
+    uint16_t crc = crc16(frame.data(), frame.size());
+    if (bad)
+        crc ^= 0x5A5A;
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+    uint8_t header[CAPTURE_HEADER] = {0, 0, 0, 0, direction, (uint8_t)frame.size()};
+    capture.insert(capture.end(), header, header + CAPTURE_HEADER);
+    capture.insert(capture.end(), frame.begin(), frame.end());
+}
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[16] = {0};
+    uint16_t scratch[16] = {0};
+    Packet packets[1];
+    Turnaround guards[4];
+    uint16_t level = 0;
+    Point points[] = { modbusPoint<uint16_t, ORDER_ABCD>("level", 1, level) };
+    PointMap level_map;
+
+    memset(packets, 0, sizeof(packets));
+    master.configure(packets, 1, regs);
+    master.map(&level_map, points, 1, 0);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 2, 0);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 0, 3, 2);
+    master.gap(GAP_ADAPTIVE, guards, 4);
+    guards[0].id = 1;
+    guards[0].guard = 700;
+    run(master, 300);   //trace ring holds live events
+    assert(master._trace_head != master._trace_tail);
+    assert(level == 10);
+
+    //Slave 1 fails 3 times, replayed packet is given up. Then one good response
+    for (int i = 0; i < 3; i++)
+    {
+        record(CAPTURE_TX, {1, READ_HOLDING_REGISTERS, 0, 0, 0, 2});
+        record(CAPTURE_RX, {1, READ_HOLDING_REGISTERS, 4, 0, 1, 0, 2}, true);
+    }
+    record(CAPTURE_TX, {1, READ_HOLDING_REGISTERS, 0, 0, 0, 2});
+    record(CAPTURE_RX, {1, READ_HOLDING_REGISTERS, 4, 0, 1, 0, 2});
+
+    Turnaround guards_before[4];
+    TraceRecord trace_before[TRACE_RECORDS];
+    memcpy(guards_before, guards, sizeof(guards));
+    memcpy(trace_before, master._trace, sizeof(trace_before));
+    uint8_t head = master._trace_head, tail = master._trace_tail;
+    uint16_t lost = master.trace_lost();
+
+    assert(master.replay(capture.data(), capture.size(), scratch) == 4);
+    assert(scratch[0] == 1 && scratch[1] == 2);
+    assert(memcmp(guards, guards_before, sizeof(guards)) == 0);
+    assert(memcmp(master._trace, trace_before, sizeof(trace_before)) == 0);
+    assert(master._trace_head == head && master._trace_tail == tail && master.trace_lost() == lost);
+    assert(level == 10);
+
+    //Fuzzed frame goes to the scratch registers only
+    uint8_t frame[] = {1, READ_HOLDING_REGISTERS, 4, 0, 0, 0x12, 0x34, 0, 0};
+    uint16_t crc = crc16(frame, 7);
+    frame[7] = crc & 0xFF;
+    frame[8] = crc >> 8;
+    assert(master.decode(&packets[0], frame, sizeof(frame), scratch) == 1);
+    assert(scratch[1] == 0x1234 && regs[1] == 10 && level == 10);
+    printf("PASS\n");
+}
@@ -0,0 +1,52 @@
+// Retry above MAX_RETRY gives up a dead slave of a packet table instead of wrapping its counter,
+// a Packet array keeps the retry given to begin()
+#include "FakeSlave.h"
+
+//Slave 9 never answers
+struct DeadNine : FakeSlave {
+    void flush()
+    {
+        silent = tx.size() && tx[0] == 9;
+        FakeSlave::flush();
+    }
+};
+
+int main()
+{
+    DeadNine slave;
+    Modbus master;
+    uint16_t regs[16];
+    PacketConfig config[2] = {{1, READ_HOLDING_REGISTERS, 0, 2, 0}, {9, READ_HOLDING_REGISTERS, 0, 2, 4}};
+    PacketState states[2];
+
+    master.configure(config, states, 2, regs);
+    master.begin(&slave, 57600, SERIAL_8E1, 5, 0, 200, 2);
+    for (long i = 0; i < 2000000 && states[1].connection; i++)
+    {
+        master.update();
+        stub_us += 50;
+    }
+
+    size_t dead = 0;
+    for (size_t i = 0; i < slave.log.size(); i++)
+        dead += (slave.log[i][0] == 9);
+    printf("given up after %zu requests\n", dead);
+    assert(!states[1].connection && dead == MAX_RETRY);
+
+    //Packet array keeps its full retry
+    DeadNine slave2;
+    Modbus master2;
+    Packet packets[1];
+    memset(packets, 0, sizeof(packets));
+    master2.configure(packets, 1, regs);
+    master2.construct(&packets[0], 9, READ_HOLDING_REGISTERS, 0, 2, 0);
+    master2.begin(&slave2, 57600, SERIAL_8E1, 5, 0, 200, 2);
+    for (long i = 0; i < 2000000 && packets[0].connection; i++)
+    {
+        master2.update();
+        stub_us += 50;
+    }
+    printf("Packet array given up after %zu requests\n", slave2.log.size());
+    assert(!packets[0].connection && slave2.log.size() == 200);
+    printf("PASS\n");
+}
@@ -0,0 +1,68 @@
+// Simulated bus checks the frame size of writes and answers function 23
+#include "FakeSlave.h"
+#include "ModbusXT_Sim.h"
+
+SimSlave sim_slaves[1];
+uint16_t image[32];
+ModbusSimBus bus;
+
+//Send a request with its CRC, return the response
+std::vector<uint8_t> ask(std::vector<uint8_t> frame)
+{
+    uint16_t crc = crc16(frame.data(), frame.size());
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+    for (size_t i = 0; i < frame.size(); i++)
+        bus.write(frame[i]);
+    bus.flush();
+    stub_us += 100000;
+
+    std::vector<uint8_t> response;
+    int data;
+    while ((data = bus.read()) >= 0)
+        response.push_back(data);
+    return response;
+}
+
+int main()
+{
+    memset(sim_slaves, 0, sizeof(sim_slaves));
+    sim_slaves[0].id = 1;
+    bus.begin(sim_slaves, 1, image, 32, 115200);
+    for (int i = 0; i < 32; i++)
+        image[i] = i;
+
+    std::vector<uint8_t> r = ask({1, 16, 0, 2, 0, 2, 4, 0, 7, 0, 8});
+    assert(r.size() == 8 && image[2] == 7 && image[3] == 8);
+
+    //3 registers, 2 sent
+    r = ask({1, 16, 0, 2, 0, 3, 4, 0, 9, 0, 9});
+    assert(r.size() == 5 && r[1] == 0x90 && r[2] == 3 && image[2] == 7);
+
+    //byte count does not match
+    r = ask({1, 16, 0, 2, 0, 1, 4, 0, 9, 0, 9});
+    assert(r.size() == 5 && r[2] == 3);
+
+    //count far past the frame
+    r = ask({1, 16, 0, 2, 0, 30, 60});
+    assert(r.size() == 5 && r[2] == 3);
+
+    //coils: 2 bytes, 1 sent
+    r = ask({1, 15, 0, 0, 0, 9, 2, 0xFF});
+    assert(r.size() == 5 && r[2] == 3);
+
+    r = ask({1, 23, 0, 10, 0, 2, 0, 20, 0, 1, 2, 0x12, 0x34});
+    assert(r.size() == 9 && r[1] == 23 && r[2] == 4 && image[20] == 0x1234 && r[4] == 10 && r[6] == 11);
+
+    //write is done before read
+    r = ask({1, 23, 0, 20, 0, 1, 0, 20, 0, 1, 2, 0xAB, 0xCD});
+    assert(r.size() == 7 && r[3] == 0xAB && r[4] == 0xCD);
+
+    //2 registers to write, 1 sent
+    r = ask({1, 23, 0, 10, 0, 2, 0, 20, 0, 2, 4, 0, 1});
+    assert(r.size() == 5 && r[1] == 0x97 && r[2] == 3);
+
+    r = ask({1, 24, 0, 0, 0, 0});
+    assert(r.size() == 5 && r[2] == 1);
+    printf("PASS\n");
+}
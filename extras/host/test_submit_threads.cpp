@@ -0,0 +1,83 @@
+// Producer threads submit requests while the master task runs update()
+#include "FakeSlave.h"
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+#define PRODUCERS 4
+#define REQUESTS 50
+
+FakeSlave slave;
+Modbus master;
+uint16_t regs[512];
+Packet cyclic[1];
+Packet packets[PRODUCERS][REQUESTS];
+ModbusRequest requests[PRODUCERS][REQUESTS];
+std::atomic<int> callbacks(0), full(0);
+
+void done(ModbusRequest* request)
+{
+    callbacks++;
+}
+
+void* producer(void* arg)
+{
+    long t = (long)arg;
+    for (int k = 0; k < REQUESTS; k++)
+    {
+        int n = t * REQUESTS + k;
+        memset(&packets[t][k], 0, sizeof(Packet));
+        regs[100 + n] = 1000 + n;
+        master.construct(&packets[t][k], 1, PRESET_SINGLE_REGISTER, n, 0, 100 + n);
+        requests[t][k].packet = &packets[t][k];
+        requests[t][k].priority = t;
+        requests[t][k].done = (k & 1) ? done : NULL;
+        while (!master.submit(&requests[t][k]))
+        {
+            full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int main()
+{
+    static QueuedPacket slots[8];
+    static SubmitSlot submit_slots[8];
+    static Turnaround guards[4];
+
+    master.configure(cyclic, 1, regs);
+    master.construct(&cyclic[0], 1, READ_HOLDING_REGISTERS, 0, 4, 0);
+    master.queue(slots, 8);
+    assert(!master.submit_queue(submit_slots, 6));  //not a power of 2
+    assert(!master.submit_queue(submit_slots, 1));  //filled and free sequences would meet
+    assert(!master.submit_queue(submit_slots, 0));
+    assert(master.submit_queue(submit_slots, 8));
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 0, 3, 2);
+    master.gap(GAP_ADAPTIVE, guards, 4);
+
+    pthread_t threads[PRODUCERS];
+    for (long t = 0; t < PRODUCERS; t++)
+        pthread_create(&threads[t], NULL, producer, (void*)t);
+
+    int finished = 0;
+    for (long loops = 0; finished < PRODUCERS * REQUESTS && loops < 50000000; loops++)
+    {
+        master.update();
+        stub_us += 50;
+        finished = 0;
+        for (int t = 0; t < PRODUCERS; t++)
+            for (int k = 0; k < REQUESTS; k++)
+                finished += (__atomic_load_n(&requests[t][k].status, __ATOMIC_ACQUIRE) == REQUEST_DONE);
+    }
+    for (int t = 0; t < PRODUCERS; t++)
+        pthread_join(threads[t], NULL);
+
+    int bad = 0;
+    for (int n = 0; n < PRODUCERS * REQUESTS; n++)
+        bad += (slave.hold[n & 255] != 1000 + n);
+    printf("finished %d, callbacks %d, ring full %d times\n", finished, (int)callbacks, (int)full);
+    assert(finished == PRODUCERS * REQUESTS && callbacks == PRODUCERS * REQUESTS / 2 && bad == 0);
+    printf("PASS\n");
+}
@@ -0,0 +1,58 @@
+// A request submitted while its packet is on the wire gets registers of a later transaction
+#include "FakeSlave.h"
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[16] = {0};
+    Packet cyclic[1], packet;
+    ModbusRequest r1, r2, r3, r4;
+    QueuedPacket slots[4];
+    SubmitSlot submit_slots[2];
+
+    memset(&r1, 0, sizeof(r1));
+    memset(&r2, 0, sizeof(r2));
+    memset(&r3, 0, sizeof(r3));
+    memset(&r4, 0, sizeof(r4));
+    master.configure(cyclic, 1, regs);
+    master.construct(&cyclic[0], 2, READ_HOLDING_REGISTERS, 0, 1, 8);
+    master.construct(&packet, 1, READ_HOLDING_REGISTERS, 7, 1, 0);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 0, 3, 2);
+
+    //No storage
+    assert(!master.submit(&r3) && r3.status == REQUEST_FAILED);
+
+    master.queue(slots, 4);
+    master.submit_queue(submit_slots, 2);
+    slave.hold[7] = 111;
+    slave.latency_us = 5000;
+    r1.packet = &packet;
+    r2.packet = &packet;
+    r3.packet = &packet;
+    assert(master.submit(&r1) && r1.status == REQUEST_PENDING);
+
+    //Packet is on the wire, slave answers 111
+    size_t sent = slave.log.size();
+    for (int i = 0; i < 100000 && !(slave.log.size() > sent && slave.log.back()[0] == 1); i++)
+        run(master, 1, 10);
+    assert(slave.log.back()[0] == 1);
+
+    slave.hold[7] = 222;
+    assert(master.submit(&r2));
+    assert(master.submit(&r3));
+    r4.packet = &packet;
+    r4.status = REQUEST_DONE;
+    assert(!master.submit(&r4) && r4.status == REQUEST_FAILED);   //ring full
+
+    bool seen_111 = false;
+    for (int i = 0; i < 200000 && (r2.status == REQUEST_PENDING || r3.status == REQUEST_PENDING); i++)
+    {
+        run(master, 1, 10);
+        if (r1.status == REQUEST_DONE && regs[0] == 111)
+            seen_111 = true;
+    }
+    assert(r1.status == REQUEST_DONE && r2.status == REQUEST_DONE && r3.status == REQUEST_DONE);
+    assert(regs[0] == 222 && seen_111);
+    printf("PASS\n");
+}
@@ -0,0 +1,45 @@
+// Trace records CRC errors and timeouts, drained records are not read twice (MODBUS_TRACE=1)
+// Usage: test_trace [file], records are also written to file for extras/trace_decode.py
+#include "FakeSlave.h"
+
+int main(int argc, char** argv)
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[64];
+    Packet packets[2];
+    uint8_t buffer[64];
+    int events[16] = {0};
+    FILE* file = argc > 1 ? fopen(argv[1], "wb") : NULL;
+
+    master.configure(packets, 2, regs);
+    master.construct(&packets[0], 1, READ_HOLDING_REGISTERS, 0, 4, 0);
+    master.construct(&packets[1], 1, PRESET_SINGLE_REGISTER, 5, 0, 10);
+    master.begin(&slave, 57600, SERIAL_8E1, 50, 5, 100, 2);
+
+    for (int i = 0; i < 4000; i++)
+    {
+        slave.corrupt = (i >= 1000 && i < 1500);
+        slave.silent = (i >= 2000 && i < 3000);
+        run(master, 1, 200);
+
+        if (i % 100 != 99)
+            continue;
+        uint16_t size;
+        while ((size = master.trace_read(buffer, sizeof(buffer))))
+        {
+            assert(size % TRACE_RECORD == 0);
+            for (uint16_t j = 0; j < size; j += TRACE_RECORD)
+                events[buffer[j + 4]]++;
+            if (file)
+                fwrite(buffer, 1, size, file);
+        }
+    }
+    if (file)
+        fclose(file);
+
+    printf("tx %d rx %d crc %d timeout %d lost %u\n", events[TRACE_TX], events[TRACE_RX], events[TRACE_CRC], events[TRACE_TIMEOUT], master.trace_lost());
+    assert(events[TRACE_TX] > 0 && events[TRACE_RX] > 0 && events[TRACE_CRC] > 0 && events[TRACE_TIMEOUT] > 0);
+    assert(master.trace_read(buffer, sizeof(buffer)) == 0);
+    printf("PASS\n");
+}
@@ -0,0 +1,55 @@
+// submit() calls the task wake function, submitFromISR() and received() the interrupt one
+#include "FakeSlave.h"
+
+static int task_wakes = 0;
+static int isr_wakes = 0;
+
+static void wakeTask(void* arg) { task_wakes++; assert(arg == &task_wakes); }
+static void wakeISR(void* arg) { isr_wakes++; assert(arg == &task_wakes); }
+
+int main()
+{
+    FakeSlave slave;
+    Modbus master;
+    uint16_t regs[4] = {0};
+    Packet cyclic[1], packet;
+    ModbusRequest r1, r2;
+    QueuedPacket slots[2];
+    SubmitSlot submit_slots[2];
+
+    memset(&r1, 0, sizeof(r1));
+    memset(&r2, 0, sizeof(r2));
+    master.configure(cyclic, 1, regs);
+    master.construct(&cyclic[0], 1, READ_HOLDING_REGISTERS, 0, 1, 0);
+    master.construct(&packet, 1, READ_HOLDING_REGISTERS, 1, 1, 1);
+    master.begin(&slave, 57600, SERIAL_8E1, 500, 0, 3, 2);
+    master.queue(slots, 2);
+    master.submit_queue(submit_slots, 2);
+    master.wake(wakeTask, wakeISR, &task_wakes);
+
+    r1.packet = &packet;
+    r2.packet = &packet;
+    assert(master.submit(&r1));
+    assert(task_wakes == 1 && isr_wakes == 0);
+    assert(master.submitFromISR(&r2));
+    assert(task_wakes == 1 && isr_wakes == 1);
+
+    //First byte of a response wakes from the interrupt
+    slave.hold[1] = 7;
+    for (int i = 0; i < 100000 && (r1.status == REQUEST_PENDING || r2.status == REQUEST_PENDING); i++)
+    {
+        run(master, 1, 10);
+        master.received();
+    }
+    assert(r1.status == REQUEST_DONE && r2.status == REQUEST_DONE);
+    assert(task_wakes == 1 && isr_wakes > 1);
+
+    //Removed functions are not called
+    master.wake(NULL, NULL, NULL);
+    r1.status = REQUEST_PENDING;
+    assert(master.submit(&r1));
+    assert(task_wakes == 1);
+
+    printf("PASS\n");
+    return 0;
+}
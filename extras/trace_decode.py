@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Decode ModbusXT trace records, see MODBUS_TRACE in ModbusXT.h
+
+Records are 8 bytes: micros() (4 bytes), event, slave ID, value (2 bytes),
+numbers low byte first.
+
+Usage:
+    trace_decode.py dump.bin              binary records, e.g. from trace_dump(&Serial)
+    trace_decode.py --hex dump.txt        hex bytes, whitespace is ignored
+    trace_decode.py --registers 1 2 ...   registers read over Modbus, high byte first
+Without a file, records are read from stdin.
+"""
+
+import argparse
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBH")
+
+FUNCTIONS = {
+    1: "read coils", 2: "read inputs", 3: "read holding", 4: "read input regs",
+    5: "write coil", 6: "write register", 15: "write coils", 16: "write registers",
+    22: "mask write", 23: "read/write",
+}
+
+EXCEPTIONS = {
+    1: "illegal function", 2: "illegal data address", 3: "illegal data value",
+    4: "slave device failure", 6: "slave device busy",
+}
+
+
+def tx(value):
+    function = value >> 8
+    return "%s, %d bytes" % (FUNCTIONS.get(function, "function %d" % function), value & 0xFF)
+
+
+EVENTS = {
+    1: ("TX", tx),
+    2: ("RX", lambda v: "%d bytes" % v),
+    3: ("GAP", lambda v: "silence after %d bytes" % v),
+    4: ("FRAME", lambda v: "broken frame, %d bytes" % v),
+    5: ("SLAVE", lambda v: "answer of slave %d" % v),
+    6: ("CRC", lambda v: "received CRC 0x%04X" % v),
+    7: ("FUNCTION", lambda v: "answer to function %d" % (v & 0x7F)),
+    8: ("EXCEPTION", lambda v: EXCEPTIONS.get(v, "exception %d" % v)),
+    9: ("LENGTH", lambda v: "unexpected size, %d bytes" % v),
+    10: ("TIMEOUT", lambda v: "no answer after %d ms" % v),
+    11: ("RETRY", lambda v: "failed, retry %d" % v),
+    12: ("GIVE_UP", lambda v: "max retry reached"),
+}
+
+
+def read_bytes(args):
+    if args.registers:
+        data = bytearray()
+        for register in args.registers:
+            value = int(register, 0)
+            data += bytes((value >> 8, value & 0xFF))
+        return bytes(data)
+
+    if args.hex:
+        text = open(args.file).read() if args.file else sys.stdin.read()
+        return bytes.fromhex("".join(text.split()))
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            return f.read()
+    return sys.stdin.buffer.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode ModbusXT trace records")
+    parser.add_argument("file", nargs="?", help="file with records, stdin if omitted")
+    parser.add_argument("--hex", action="store_true", help="records are hex text")
+    parser.add_argument("--registers", nargs="+", metavar="REG", help="records as register values")
+    args = parser.parse_args()
+
+    data = read_bytes(args)
+    if len(data) % RECORD.size:
+        print("warning: %d trailing bytes ignored" % (len(data) % RECORD.size), file=sys.stderr)
+
+    previous = None
+    for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        time, event, slave, value = RECORD.unpack_from(data, offset)
+        delta = 0 if previous is None else (time - previous) & 0xFFFFFFFF
+        previous = time
+        name, detail = EVENTS.get(event, ("EVENT %d" % event, lambda v: "value %d" % v))
+        print("%10d us  +%8d  slave %3d  %-9s  %s" % (time, delta, slave, name, detail(value)))
+
+
+if __name__ == "__main__":
+    main()